@@ -11,6 +11,9 @@
  */
 
 #include <stdint.h>
+#include <stdlib.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
 #include "lwip/sockets.h"
 #include "lwip/netdb.h"
 #include "esp_log.h"
@@ -28,66 +31,135 @@ uint8_t udp_rx_buffer[ECONET_MTU + 64];
 static const char *TAG = "AUN";
 static const char *ECONETTAG = "ECONET";
 
+// A station's MACHINETYPE reply doesn't change, so answer AUN requests for it
+// from a cache rather than running the scout/reply exchange on the line
+// every time a tool polls the network. Set to 0 to always ask the station.
+#define AUN_MACHINETYPE_CACHE_TTL_MS 60000
+
 static bool is_running;
 static volatile TaskHandle_t shutdown_notify_handle;
-static QueueHandle_t ack_queue;
+static QueueHandle_t aun_tx_queue; ///< Packets from Econet waiting to be given to a peer
+static TaskHandle_t aun_tx_task;
 static int rx_udp_ctl_pipe[2];
 
-typedef struct
+// TX task notification bits. Packets are passed on aun_tx_queue and ACKs
+// in the peer they came from.
+#define AUN_TX_NOTIFY_PKT (1 << 0)
+#define AUN_TX_NOTIFY_ACK (1 << 1)
+#define AUN_TX_NOTIFY_SHUTDOWN (1 << 2)
+
+static QueueHandle_t delivery_queue;  ///< Deliveries waiting for the worker
+static QueueHandle_t delivered_queue; ///< Deliveries finished by the worker, waiting to be answered
+static TaskHandle_t delivery_task;
+
+// Delivery task notification bits. Deliveries are passed on delivery_queue,
+// and the TX requests for those in flight say when they're done.
+#define AUN_DELIVERY_NOTIFY_QUEUED (1 << 0)
+#define AUN_DELIVERY_NOTIFY_DONE (1 << 1)
+#define AUN_DELIVERY_NOTIFY_SHUTDOWN (1 << 2)
+static int delivery_count; ///< Deliveries allocated, only touched by the UDP RX task while it runs
+
+static aunbridge_peer_t *peers;       ///< AUN stations and open trunks
+static SemaphoreHandle_t peers_lock; ///< Held while peers are being set up, for readers outside the TX task
+static uint32_t tx_rto_cap_us;
+
+// Stations are allocated as they're configured, as many as there are, and
+// kept on lists. Looking one up by station ID is a direct index, and AUN
+// stations are also hashed on the address they send from.
+typedef struct econet_station
 {
+    struct econet_station *next;
     uint8_t station_id;
     uint8_t network_id;
     uint16_t local_udp_port;
     int socket;
-    bool is_open;
+    int64_t machinetype_expiry_us; ///< Cached MACHINETYPE reply valid until, 0 if none
+    uint16_t machinetype_len;
+    uint8_t machinetype[8];
 } econet_station_t;
-static econet_station_t econet_stations[5];
+static econet_station_t *econet_stations;
+static econet_station_t *econet_station_by_id[256];
+
+// AUN stations share the TX sources not taken by trunks
+#define AUN_TX_SOURCES (ECONET_TX_SOURCES - ARRAY_SIZE(trunks))
 
-typedef struct
+typedef struct aun_station
 {
+    aunbridge_peer_t peer;
+    struct aun_station *next;
+    struct aun_station *addr_next; ///< Next in the same address hash bucket
     char remote_address[64];
+    in_addr_t remote_ip;           ///< remote_address, network byte order
     uint8_t station_id;
     uint8_t network_id;
     uint16_t udp_port;
+    uint8_t tx_source;
     uint32_t last_acked_seq;
     econet_acktype_t last_tx_result;
+    uint8_t deliveries;            ///< Frames from this station waiting for or in delivery
+    uint32_t delivering_seq;       ///< Sequence number of the last of them
 } aun_station_t;
-static aun_station_t aun_stations[20];
+static aun_station_t *aun_stations;
+static int aun_station_count;
+static aun_station_t *aun_station_by_id[256];
+static aun_station_t **aun_station_by_addr; ///< Hash buckets, aun_station_by_addr_mask + 1 of them
+static uint32_t aun_station_by_addr_mask;
 
-static econet_station_t *_get_econet_station_by_id(uint8_t station_id)
+static inline econet_station_t *_get_econet_station_by_id(uint8_t station_id)
 {
-    for (int i = 0; i < ARRAY_SIZE(econet_stations); i++)
-    {
-        if (econet_stations[i].station_id == station_id)
-        {
-            return &econet_stations[i];
-        }
-    }
-    return NULL;
+    return econet_station_by_id[station_id];
+}
+
+static inline aun_station_t *_get_aun_station_by_id(uint8_t station_id)
+{
+    return aun_station_by_id[station_id];
+}
+
+static inline uint32_t _aun_addr_hash(in_addr_t ip, uint16_t udp_port)
+{
+    uint32_t h = (ip ^ ((uint32_t)udp_port << 16 | udp_port)) * 0x9E3779B1u;
+    return (h ^ (h >> 16)) & aun_station_by_addr_mask;
 }
 
-static aun_station_t *_get_aun_station_by_id(uint8_t station_id)
+/*** Find the AUN station sending from ip (network byte order) and udp_port */
+static aun_station_t *_get_aun_station_by_addr(in_addr_t ip, uint16_t udp_port)
 {
-    for (int i = 0; i < ARRAY_SIZE(aun_stations); i++)
+    if (aun_station_by_addr == NULL)
+    {
+        return NULL;
+    }
+    for (aun_station_t *station = aun_station_by_addr[_aun_addr_hash(ip, udp_port)]; station != NULL; station = station->addr_next)
     {
-        if (aun_stations[i].station_id == station_id)
+        if (station->remote_ip == ip && station->udp_port == udp_port)
         {
-            return &aun_stations[i];
+            return station;
         }
     }
     return NULL;
 }
 
-static aun_station_t *_get_aun_station_by_port(uint16_t udp_port)
+/*** Hash the configured AUN stations on the address they send from */
+static void _index_aun_stations(void)
 {
-    for (int i = 0; i < ARRAY_SIZE(aun_stations); i++)
+    uint32_t buckets = 1;
+    while (buckets < 2 * aun_station_count)
     {
-        if (aun_stations[i].udp_port == udp_port)
-        {
-            return &aun_stations[i];
-        }
+        buckets <<= 1;
+    }
+    aun_station_by_addr = calloc(buckets, sizeof(aun_station_t *));
+    if (aun_station_by_addr == NULL)
+    {
+        ESP_LOGE(TAG, "No memory for AUN station address table");
+        return;
+    }
+    aun_station_by_addr_mask = buckets - 1;
+
+    for (aun_station_t *station = aun_stations; station != NULL; station = station->next)
+    {
+        uint32_t h = _aun_addr_hash(station->remote_ip, station->udp_port);
+        station->addr_next = aun_station_by_addr[h];
+        aun_station_by_addr[h] = station;
     }
-    return NULL;
 }
 
 static bool _econet_rx(econet_rx_packet_t *pkt, uint32_t timeout)
@@ -108,165 +180,523 @@ static bool _econet_rx(econet_rx_packet_t *pkt, uint32_t timeout)
     return true;
 }
 
-void aunbridge_signal_ack(uint32_t seq)
+void aunbridge_signal_ack(aunbridge_peer_t *peer, uint32_t seq, bool is_nack)
 {
-    xQueueSend(ack_queue, &seq, 0);
+    uint8_t tail = peer->ack_tail;
+    if ((uint8_t)(tail - peer->ack_head) >= AUN_TX_ACKS)
+    {
+        ESP_LOGW(TAG, "Too many ACKs waiting from %s. Dropped seq=0x%x", peer->name, seq);
+        return;
+    }
+    peer->acks[tail % AUN_TX_ACKS] = (aunbridge_ack_t){.seq = seq, .is_nack = is_nack};
+    peer->ack_tail = tail + 1;
+    xTaskNotify(aun_tx_task, AUN_TX_NOTIFY_ACK, eSetBits);
+}
+
+/*** Get a station's cached MACHINETYPE reply, if it hasn't expired */
+static bool _get_cached_machinetype(econet_station_t *econet_station, uint8_t **reply, uint16_t *reply_len)
+{
+    if (econet_station->machinetype_expiry_us == 0 || esp_timer_get_time() >= econet_station->machinetype_expiry_us)
+    {
+        aunbridge_stats.imm_cache_miss_count++;
+        return false;
+    }
+    aunbridge_stats.imm_cache_hit_count++;
+    *reply = econet_station->machinetype;
+    *reply_len = econet_station->machinetype_len;
+    return true;
+}
+
+/*** Remember a station's answer to MACHINETYPE, or forget it if there wasn't one */
+static void _cache_machinetype(econet_station_t *econet_station, econet_acktype_t result, const uint8_t *reply, uint16_t reply_len)
+{
+    if (result != ECONET_IMM_REPLY || reply == NULL || reply_len > sizeof(econet_station->machinetype))
+    {
+        econet_station->machinetype_expiry_us = 0;
+        return;
+    }
+    memcpy(econet_station->machinetype, reply, reply_len);
+    econet_station->machinetype_len = reply_len;
+    econet_station->machinetype_expiry_us = esp_timer_get_time() + AUN_MACHINETYPE_CACHE_TTL_MS * 1000LL;
 }
 
-bool aunbridge_wait_ack(uint32_t seq)
+/*** Send a packet from Econet to the AUN station it's addressed to */
+static bool _aun_station_send(aunbridge_peer_t *peer, aunbridge_tx_t *tx)
 {
-    uint32_t ack_seq;
-    for (int i = 0; i < 5; i++)
+    aun_station_t *aun_station = peer->ctx;
+    econet_station_t *econet_station = _get_econet_station_by_id(tx->scout.hdr.src_stn);
+
+    struct sockaddr_in dest_addr;
+    dest_addr.sin_addr.s_addr = aun_station->remote_ip;
+    dest_addr.sin_family = AF_INET;
+    dest_addr.sin_port = htons(aun_station->udp_port);
+
+    uint8_t *aun_packet = tx->pkt.data + ECONET_RX_BUFFER_WORKSPACE - 4;
+    aun_packet[0] = AUN_TYPE_DATA;
+    aun_packet[1] = tx->scout.port;
+    aun_packet[2] = tx->scout.control & 0x7F;
+    aun_packet[3] = 0x00;
+    aun_packet[4] = (tx->seq >> 0) & 0xFF;
+    aun_packet[5] = (tx->seq >> 8) & 0xFF;
+    aun_packet[6] = (tx->seq >> 16) & 0xFF;
+    aun_packet[7] = (tx->seq >> 24) & 0xFF;
+
+    int err = sendto(econet_station->socket, aun_packet, tx->pkt.length - sizeof(econet_hdr_t) + 8, 0,
+                     (struct sockaddr *)&dest_addr, sizeof(dest_addr));
+    if (err < 0)
     {
-        if (xQueueReceive(ack_queue, &ack_seq, 500) == pdPASS)
+        ESP_LOGE(TAG, "Error occurred during sending: errno %d", errno);
+        aunbridge_stats.tx_error_count++;
+        return false;
+    }
+    return true;
+}
+
+static inline aunbridge_tx_t *_peer_tx(aunbridge_peer_t *peer, int i)
+{
+    return &peer->backlog[(peer->head + i) % AUN_TX_BACKLOG];
+}
+
+/*** Hold a packet for a peer until it's ACKed, or drop it if the peer's backed up */
+static void _peer_push(aunbridge_peer_t *peer, econet_rx_packet_t *pkt, const econet_scout_t *scout)
+{
+    static uint32_t tx_seq;
+
+    if (peer->count == AUN_TX_BACKLOG)
+    {
+        ESP_LOGW(TAG, "Already holding %d packets for %s. Dropping packet.", AUN_TX_BACKLOG, peer->name);
+        aunbridge_stats.tx_abort_count++;
+        econet_rx_packet_free(pkt);
+        return;
+    }
+
+    aunbridge_stats.tx_count++;
+
+    // It could be held for as long as the peer takes to ACK, so don't tie
+    // up one of the few receive buffers. Dead peers would soon use up the
+    // pools and the receiver would drop frames for every station.
+    econet_buf_t *buf = econet_buf_unpool(pkt->buf, pkt->length);
+    if (buf != pkt->buf)
+    {
+        pkt->buf = buf;
+        pkt->data = buf->data;
+    }
+
+    tx_seq += 4;
+
+    aunbridge_tx_t *tx = _peer_tx(peer, peer->count++);
+    tx->pkt = *pkt;
+    tx->scout = *scout;
+    tx->seq = tx_seq;
+    tx->deadline_us = 0;
+    tx->tries_left = AUN_TX_TRIES;
+    tx->is_nacked = false;
+}
+
+/*** Send what each peer's window allows and resend anything not ACKed in
+ * time. Returns when the next ACK wait runs out, INT64_MAX if nothing is in
+ * flight.
+ */
+static int64_t _peers_service(void)
+{
+    int64_t now_us = esp_timer_get_time();
+    int64_t next_us = INT64_MAX;
+
+    for (aunbridge_peer_t *peer = peers; peer != NULL; peer = peer->next)
+    {
+        bool is_retired;
+        do
         {
-            if (ack_seq == seq)
+            // Finished packets leave from the front, opening up the window
+            while (peer->count > 0 && _peer_tx(peer, 0)->pkt.buf == NULL)
             {
-                return true;
+                peer->head = (peer->head + 1) % AUN_TX_BACKLOG;
+                peer->count--;
             }
-            else
+
+            is_retired = false;
+            for (int i = 0; i < peer->count && i < AUN_TX_WINDOW; i++)
             {
-                ESP_LOGW(TAG, "Ignoring out-of-sequence ACK received=0x%x expecting=0x%x", ack_seq, seq);
+                aunbridge_tx_t *tx = _peer_tx(peer, i);
+                if (tx->pkt.buf == NULL)
+                {
+                    continue;
+                }
+                if (tx->deadline_us > now_us)
+                {
+                    if (tx->deadline_us < next_us)
+                    {
+                        next_us = tx->deadline_us;
+                    }
+                    continue;
+                }
+                if (tx->deadline_us == 0)
+                {
+                    tx->first_sent_us = now_us;
+                }
+                else if (tx->tries_left == 0 || now_us - tx->first_sent_us >= AUN_TX_GIVE_UP_MS * 1000LL)
+                {
+                    ESP_LOGW(TAG, "Retries exhausted, no response from %s", peer->name);
+                    aunbridge_stats.tx_abort_count++;
+                    econet_rx_packet_free(&tx->pkt);
+                    is_retired = true;
+                    continue;
+                }
+                else
+                {
+                    if (tx->is_nacked)
+                    {
+                        tx->is_nacked = false;
+                    }
+                    else
+                    {
+                        // Back off (RFC 6298 5.5)
+                        peer->rto_us = peer->rto_us * 2 < tx_rto_cap_us ? peer->rto_us * 2 : tx_rto_cap_us;
+                    }
+                    peer->retry_count++;
+                    aunbridge_stats.tx_retry_count++;
+                    ESP_LOGI(TAG, "Retry! %d remain, waiting %lums", tx->tries_left - 1, peer->rto_us / 1000);
+                }
+                tx->tries_left--;
+                peer->send(peer, tx);
+                tx->deadline_us = now_us + peer->rto_us;
+                if (tx->deadline_us < next_us)
+                {
+                    next_us = tx->deadline_us;
+                }
             }
-        }
-        else
-        {
-            return false;
-        }
+        } while (is_retired);
     }
-    ESP_LOGW(TAG, "Too many out-of-sequence ACK!");
-    return false;
+
+    return next_us;
 }
 
-static void _aun_econet_rx_task(void *params)
+/*** Fold a round trip time into a peer's retransmission timeout (RFC 6298) */
+static void _peer_rtt_sample(aunbridge_peer_t *peer, uint32_t rtt_us)
 {
-    static uint32_t rx_seq;
-    econet_rx_packet_t econet_pkt;
+    if (rtt_us == 0)
+    {
+        rtt_us = 1;
+    }
+    if (rtt_us > peer->rtt_max_us)
+    {
+        peer->rtt_max_us = rtt_us;
+    }
 
-    econet_scout_t scout;
-    econet_hdr_t econet_hdr;
+    if (peer->srtt_us == 0)
+    {
+        peer->srtt_us = rtt_us;
+        peer->rttvar_us = rtt_us / 2;
+    }
+    else
+    {
+        uint32_t err_us = rtt_us > peer->srtt_us ? rtt_us - peer->srtt_us : peer->srtt_us - rtt_us;
+        peer->rttvar_us = (3 * peer->rttvar_us + err_us) / 4;
+        peer->srtt_us = (7 * peer->srtt_us + rtt_us) / 8;
+    }
 
-    for (;;)
+    // Variation is allowed at least a tick, which is as fine as we can time
+    uint32_t var_us = 4 * peer->rttvar_us;
+    if (var_us < portTICK_PERIOD_MS * 1000)
     {
-        // Get scout / immediate frame
-        _econet_rx(&econet_pkt, portMAX_DELAY);
-        if (econet_pkt.type == 'I')
-        {
-            continue; // Idle notification
-        }
-        else if (econet_pkt.length < 6)
+        var_us = portTICK_PERIOD_MS * 1000;
+    }
+    peer->rto_us = peer->srtt_us + var_us;
+    if (peer->rto_us < AUN_TX_RTO_MIN_MS * 1000)
+    {
+        peer->rto_us = AUN_TX_RTO_MIN_MS * 1000;
+    }
+    if (peer->rto_us > tx_rto_cap_us)
+    {
+        peer->rto_us = tx_rto_cap_us;
+    }
+}
+
+/*** Match the ACKs a peer has sent against its packets in flight.
+ *
+ * An ACK finishes the packet. A NACK means the peer got the packet but
+ * couldn't deliver it, so it goes again straight away rather than after a
+ * timeout.
+ */
+static void _peer_match_acks(aunbridge_peer_t *peer)
+{
+    while (peer->ack_head != peer->ack_tail)
+    {
+        aunbridge_ack_t ack = peer->acks[peer->ack_head % AUN_TX_ACKS];
+        peer->ack_head++;
+
+        aunbridge_tx_t *tx = NULL;
+        for (int i = 0; i < peer->count && i < AUN_TX_WINDOW; i++)
         {
-            ESP_LOGW(ECONETTAG, "Unexpected short scout frame (len=%d) discarded", econet_pkt.length);
-            continue;
+            aunbridge_tx_t *t = _peer_tx(peer, i);
+            if (t->pkt.buf != NULL && t->deadline_us != 0 && t->seq == ack.seq)
+            {
+                tx = t;
+                break;
+            }
         }
-        memcpy(&scout, econet_pkt.data + ECONET_RX_BUFFER_WORKSPACE, sizeof(scout));
-        if (econet_pkt.length != 6)
+        if (tx == NULL)
         {
-            ESP_LOGW(ECONETTAG, "Expected scout but got a %d byte frame from %d.%d to %d.%d. (P0x%x C0x%x) Discarding",
-                     econet_pkt.length, scout.hdr.src_net, scout.hdr.src_stn, scout.hdr.dst_net, scout.hdr.dst_stn, scout.port, scout.control);
+            ESP_LOGW(TAG, "Ignoring %s from %s for nothing in flight seq=0x%x", ack.is_nack ? "NACK" : "ACK", peer->name, ack.seq);
             continue;
         }
 
-        // Get data packet
-        if (!_econet_rx(&econet_pkt, 10000))
-        {
-            ESP_LOGW(ECONETTAG, "Timeout waiting for data packet from %d.%d to %d.%d (ctrl=0x%x, port=0x%x). No clock?",
-                     scout.hdr.src_net, scout.hdr.src_stn, scout.hdr.dst_net, scout.hdr.dst_stn, scout.control, scout.port);
-            continue;
-        }
-        else if (econet_pkt.type == 'I')
+        // Only time packets sent once, as an ACK for one sent again
+        // could be for either send (Karn's algorithm).
+        if (tx->tries_left == AUN_TX_TRIES - 1)
         {
-            ESP_LOGW(ECONETTAG, "Idle whilst getting data packet from %d.%d to %d.%d (ctrl=0x%x, port=0x%x)",
-                     scout.hdr.src_net, scout.hdr.src_stn, scout.hdr.dst_net, scout.hdr.dst_stn, scout.control, scout.port);
-            continue;
+            _peer_rtt_sample(peer, esp_timer_get_time() - tx->first_sent_us);
         }
-        else if (econet_pkt.length < 6)
+
+        if (ack.is_nack)
         {
-            ESP_LOGW(ECONETTAG, "Unexpected short frame discarded");
-            continue;
+            tx->is_nacked = true;
+            tx->deadline_us = esp_timer_get_time();
         }
-        memcpy(&econet_hdr, econet_pkt.data + ECONET_RX_BUFFER_WORKSPACE, sizeof(econet_hdr));
-        ESP_LOGI(ECONETTAG, "Data packet %d bytes from %d.%d to %d.%d (ctrl=0x%x, port=0x%x)",
-                 econet_pkt.length - 4,
-                 econet_hdr.src_net, econet_hdr.src_stn,
-                 econet_hdr.dst_net, econet_hdr.dst_stn,
-                 scout.control, scout.port);
-
-        if (memcmp(&econet_hdr, &scout, sizeof(econet_hdr)) != 0)
+        else
         {
-            ESP_LOGW(ECONETTAG, "Address mismatch on scout/data packet. Discarded.");
-            continue;
+            econet_rx_packet_free(&tx->pkt);
         }
+    }
+}
 
-        // See if trunk wants this packet.
-        if (trunk_tx_packet(&scout,
-                            econet_pkt.data + ECONET_RX_BUFFER_WORKSPACE, econet_pkt.length, ECONET_MTU + 16, ECONET_RX_BUFFER_WORKSPACE))
+/*** Drop every packet held for a peer */
+static void _peers_flush(void)
+{
+    for (aunbridge_peer_t *peer = peers; peer != NULL; peer = peer->next)
+    {
+        for (int i = 0; i < peer->count; i++)
         {
-            continue;
+            econet_rx_packet_free(&_peer_tx(peer, i)->pkt);
         }
+        peer->head = 0;
+        peer->count = 0;
+    }
+}
 
-        econet_station_t *econet_station = _get_econet_station_by_id(econet_hdr.src_stn);
+/*** Pick the peer for a packet from Econet and hand it over */
+static void _forward_econet_packet(econet_rx_packet_t *econet_pkt)
+{
+    econet_scout_t scout;
+    memcpy(&scout.hdr, econet_pkt->data + ECONET_RX_BUFFER_WORKSPACE, sizeof(scout.hdr));
+    scout.control = econet_pkt->control;
+    scout.port = econet_pkt->port;
+
+    ESP_LOGI(ECONETTAG, "Data packet %d bytes from %d.%d to %d.%d (ctrl=0x%x, port=0x%x)",
+             econet_pkt->length - 4,
+             scout.hdr.src_net, scout.hdr.src_stn,
+             scout.hdr.dst_net, scout.hdr.dst_stn,
+             scout.control, scout.port);
+
+    // See if trunk wants this packet.
+    aunbridge_peer_t *peer = trunk_route(&scout);
+    if (peer == NULL)
+    {
+        econet_station_t *econet_station = _get_econet_station_by_id(scout.hdr.src_stn);
         if (econet_station == NULL)
         {
             // FUTURE: Dynamically make a socket for it...
-            ESP_LOGW(TAG, "Econet station %d is not configured. Not forwarding packet", econet_hdr.src_stn);
-            continue;
+            ESP_LOGW(TAG, "Econet station %d is not configured. Not forwarding packet", scout.hdr.src_stn);
+            econet_rx_packet_free(econet_pkt);
+            return;
         }
 
-        aun_station_t *aun_station = _get_aun_station_by_id(econet_hdr.dst_stn);
+        aun_station_t *aun_station = _get_aun_station_by_id(scout.hdr.dst_stn);
         if (aun_station == NULL)
         {
-            ESP_LOGE(TAG, "AUN station %d is not configured but we accepted a packet for it!", econet_hdr.dst_stn);
-            continue;
+            ESP_LOGE(TAG, "AUN station %d is not configured but we accepted a packet for it!", scout.hdr.dst_stn);
+            econet_rx_packet_free(econet_pkt);
+            return;
         }
+        peer = &aun_station->peer;
+    }
 
-        struct sockaddr_in dest_addr;
-        dest_addr.sin_addr.s_addr = inet_addr(aun_station->remote_address);
-        dest_addr.sin_family = AF_INET;
-        dest_addr.sin_port = htons(aun_station->udp_port);
-
-        aunbridge_stats.tx_count++;
+    _peer_push(peer, econet_pkt, &scout);
+}
 
-        rx_seq += 4;
+/*** Forward packets from Econet to AUN stations and trunks.
+ *
+ * Each peer has its own window of packets in flight, each sent again until
+ * it's ACKed or runs out of tries, so waiting on one peer doesn't hold up
+ * any other.
+ */
+static void _aun_tx_task(void *params)
+{
+    int64_t next_us = INT64_MAX;
 
-        uint8_t *aun_packet = econet_pkt.data + ECONET_RX_BUFFER_WORKSPACE - 4;
-        int retries = 5;
-        while (--retries > 0)
+    for (;;)
+    {
+        TickType_t timeout = portMAX_DELAY;
+        if (next_us != INT64_MAX)
         {
-            aun_packet[0] = AUN_TYPE_DATA;
-            aun_packet[1] = scout.port;
-            aun_packet[2] = scout.control & 0x7F;
-            aun_packet[3] = 0x00;
-            aun_packet[4] = (rx_seq >> 0) & 0xFF;
-            aun_packet[5] = (rx_seq >> 8) & 0xFF;
-            aun_packet[6] = (rx_seq >> 16) & 0xFF;
-            aun_packet[7] = (rx_seq >> 24) & 0xFF;
+            int64_t wait_us = next_us - esp_timer_get_time();
+            timeout = wait_us > 0 ? pdMS_TO_TICKS((wait_us + 999) / 1000) + 1 : 0;
+        }
+
+        uint32_t notify = 0;
+        xTaskNotifyWait(0, UINT32_MAX, &notify, timeout);
 
-            int err = sendto(econet_station->socket, aun_packet, econet_pkt.length - sizeof(econet_hdr) + 8, 0,
-                             (struct sockaddr *)&dest_addr, sizeof(dest_addr));
-            if (err < 0)
+        if (notify & AUN_TX_NOTIFY_SHUTDOWN)
+        {
+            econet_rx_packet_t econet_pkt;
+            while (xQueueReceive(aun_tx_queue, &econet_pkt, 0) == pdPASS)
             {
-                ESP_LOGE(TAG, "Error occurred during sending: errno %d", errno);
-                aunbridge_stats.tx_error_count++;
+                econet_rx_packet_free(&econet_pkt);
             }
+            _peers_flush();
+            ESP_LOGI(TAG, "AUN: TX shutdown");
+            xTaskNotifyGive(shutdown_notify_handle);
+            vTaskDelete(NULL);
+        }
 
-            if (aunbridge_wait_ack(rx_seq))
+        if (notify & AUN_TX_NOTIFY_ACK)
+        {
+            for (aunbridge_peer_t *peer = peers; peer != NULL; peer = peer->next)
             {
-                break;
+                _peer_match_acks(peer);
             }
+        }
 
-            aunbridge_stats.tx_retry_count++;
-            ESP_LOGI(TAG, "Retry! %d remain", retries - 1);
+        econet_rx_packet_t econet_pkt;
+        while (xQueueReceive(aun_tx_queue, &econet_pkt, 0) == pdPASS)
+        {
+            _forward_econet_packet(&econet_pkt);
         }
 
-        if (retries == 0)
+        next_us = _peers_service();
+    }
+}
+
+static void _aun_econet_rx_task(void *params)
+{
+    econet_rx_packet_t econet_pkt;
+
+    for (;;)
+    {
+        _econet_rx(&econet_pkt, portMAX_DELAY);
+
+        if (econet_pkt.type == 'F')
         {
-            ESP_LOGW(TAG, "Retries exhausted, no response from server %s:%d", inet_ntoa(dest_addr.sin_addr), ntohs(dest_addr.sin_port));
-            aunbridge_stats.tx_abort_count++;
+            econet_hdr_t hdr;
+            memcpy(&hdr, econet_pkt.data + ECONET_RX_BUFFER_WORKSPACE, sizeof(hdr));
+            ESP_LOGW(ECONETTAG, "Expected scout but got a %d byte frame from %d.%d to %d.%d. Discarding",
+                     econet_pkt.length, hdr.src_net, hdr.src_stn, hdr.dst_net, hdr.dst_stn);
+            econet_rx_packet_free(&econet_pkt);
+            continue;
         }
+
+        // The TX task owns the packet from here
+        xQueueSend(aun_tx_queue, &econet_pkt, portMAX_DELAY);
+        xTaskNotify(aun_tx_task, AUN_TX_NOTIFY_PKT, eSetBits);
     }
 }
 
+static inline bool _is_machinetype(const aun_hdr_t *hdr)
+{
+    return AUN_MACHINETYPE_CACHE_TTL_MS > 0 &&
+           hdr->transaction_type == AUN_TYPE_IMM &&
+           (hdr->econet_control | 0x80) == ECONET_CTRL_MACHINETYPE;
+}
+
+static inline uint32_t _aun_hdr_seq(const aun_hdr_t *hdr)
+{
+    return hdr->sequence[0] |
+           (hdr->sequence[1] << 8) |
+           (hdr->sequence[2] << 16) |
+           (hdr->sequence[3] << 24);
+}
+
+aunbridge_delivery_t *aunbridge_delivery_alloc(uint16_t length)
+{
+    if (delivery_count >= AUN_DELIVERIES)
+    {
+        aunbridge_stats.rx_drop_count++;
+        return NULL;
+    }
+    aunbridge_delivery_t *delivery = calloc(1, sizeof(aunbridge_delivery_t) + length);
+    if (delivery == NULL)
+    {
+        aunbridge_stats.rx_drop_count++;
+        return NULL;
+    }
+    delivery->length = length;
+    delivery_count++;
+    return delivery;
+}
+
+/*** Free a delivery. Its request is done or already released, so this never
+ * waits on the line. */
+static void _delivery_free(aunbridge_delivery_t *delivery)
+{
+    econet_tx_release(delivery->tx_req);
+    free(delivery);
+    delivery_count--;
+}
+
+void aunbridge_deliver(aunbridge_delivery_t *delivery)
+{
+    // Can't be full, there being room for every delivery
+    xQueueSend(delivery_queue, &delivery, 0);
+    xTaskNotify(delivery_task, AUN_DELIVERY_NOTIFY_QUEUED, eSetBits);
+}
+
+/*** Send an AUN station the result of delivering its frame on Econet */
+static void _aun_send_ack(econet_station_t *econet_station, aun_station_t *aun_station, aun_hdr_t hdr,
+                          econet_acktype_t result, const uint8_t *imm_reply, uint16_t imm_reply_len)
+{
+    switch (result)
+    {
+    case ECONET_ACK:
+        hdr.transaction_type = AUN_TYPE_ACK;
+        aunbridge_stats.tx_ack_count++;
+        break;
+    case ECONET_IMM_REPLY:
+        hdr.transaction_type = AUN_TYPE_IMM_REPLY;
+        aunbridge_stats.tx_ack_count++;
+        break;
+    default:
+        hdr.transaction_type = AUN_TYPE_NACK;
+        aunbridge_stats.tx_nack_count++;
+    }
+
+    // Send (N)ACK to calling station at port we have on file
+    struct sockaddr_in dest_addr;
+    dest_addr.sin_addr.s_addr = aun_station->remote_ip;
+    dest_addr.sin_family = AF_INET;
+    dest_addr.sin_port = htons(aun_station->udp_port);
+    memcpy(udp_rx_buffer, &hdr, sizeof(hdr));
+    if (imm_reply != NULL)
+    {
+        memcpy(udp_rx_buffer + sizeof(hdr), imm_reply, imm_reply_len);
+    }
+    else
+    {
+        imm_reply_len = 0;
+    }
+    sendto(econet_station->socket, udp_rx_buffer, sizeof(hdr) + imm_reply_len, 0,
+           (struct sockaddr *)&dest_addr, sizeof(dest_addr));
+}
+
+/*** Answer an AUN station now its frame has been delivered on Econet */
+static void _aun_delivered(aunbridge_delivery_t *delivery)
+{
+    aun_station_t *aun_station = delivery->from;
+    econet_station_t *econet_station = delivery->to;
+    aun_hdr_t hdr;
+    memcpy(&hdr, delivery->hdr, sizeof(hdr));
+
+    aun_station->deliveries--;
+    aun_station->last_tx_result = delivery->result;
+    aun_station->last_acked_seq = _aun_hdr_seq(&hdr);
+    if (_is_machinetype(&hdr))
+    {
+        _cache_machinetype(econet_station, delivery->result, delivery->imm_reply, delivery->imm_reply_len);
+    }
+
+    _aun_send_ack(econet_station, aun_station, hdr, delivery->result,
+                  delivery->result == ECONET_IMM_REPLY ? delivery->imm_reply : NULL, delivery->imm_reply_len);
+}
+
 static void _aun_udp_rx_process(econet_station_t *econet_station)
 {
     struct sockaddr_in source_addr;
@@ -279,13 +709,18 @@ static void _aun_udp_rx_process(econet_station_t *econet_station)
         return;
     }
 
+    if (len < sizeof(aun_hdr_t))
+    {
+        ESP_LOGW(TAG, "Dropped short AUN packet len=%d", len);
+        return;
+    }
+
     aun_hdr_t hdr;
     memcpy(&hdr, udp_rx_buffer, sizeof(hdr));
-    uint32_t ack_seq =
-        hdr.sequence[0] |
-        (hdr.sequence[1] << 8) |
-        (hdr.sequence[2] << 16) |
-        (hdr.sequence[3] << 24);
+    uint32_t ack_seq = _aun_hdr_seq(&hdr);
+
+    // Look up sending AUN station
+    aun_station_t *aun_station = _get_aun_station_by_addr(source_addr.sin_addr.s_addr, ntohs(source_addr.sin_port));
 
     switch (hdr.transaction_type)
     {
@@ -300,11 +735,17 @@ static void _aun_udp_rx_process(econet_station_t *econet_station)
         break;
     case AUN_TYPE_ACK:
         aunbridge_stats.rx_ack_count++;
-        aunbridge_signal_ack(ack_seq);
+        if (aun_station != NULL)
+        {
+            aunbridge_signal_ack(&aun_station->peer, ack_seq, false);
+        }
         return;
     case AUN_TYPE_NACK:
         aunbridge_stats.rx_nack_count++;
-        aunbridge_signal_ack(ack_seq);
+        if (aun_station != NULL)
+        {
+            aunbridge_signal_ack(&aun_station->peer, ack_seq, true);
+        }
         return;
     default:
         ESP_LOGW(TAG, "Received AUN packet of unknown type 0x%02x. Ignored.", udp_rx_buffer[0]);
@@ -312,8 +753,6 @@ static void _aun_udp_rx_process(econet_station_t *econet_station)
         return;
     }
 
-    // Look up sending AUN station
-    aun_station_t *aun_station = _get_aun_station_by_port(ntohs(source_addr.sin_port));
     if (aun_station == NULL)
     {
         ESP_LOGW(TAG, "Received AUN packet but can't identify station ID. Ignored.");
@@ -332,9 +771,29 @@ static void _aun_udp_rx_process(econet_station_t *econet_station)
     // Send to Beeb (but only if we didn't get acknowledgement before for this packet.)
     // NOTE: We're not encountering out of order but if we do then we'll need a different strategy to reorder them.
     uint8_t *imm_reply = NULL;
-    uint16_t imm_reply_len;
-    if (ack_seq != aun_station->last_acked_seq || aun_station->last_tx_result == ECONET_NACK || aun_station->last_tx_result == ECONET_IMM_REPLY)
+    uint16_t imm_reply_len = 0;
+    bool is_new = ack_seq != aun_station->last_acked_seq || aun_station->last_tx_result == ECONET_NACK || aun_station->last_tx_result == ECONET_IMM_REPLY;
+    if (aun_station->deliveries > 0 && ack_seq == aun_station->delivering_seq)
+    {
+        ESP_LOGI(TAG, "[%05d] Ignoring duplicate still being delivered", ack_seq);
+        return;
+    }
+    else if (is_new && _is_machinetype(&hdr) && _get_cached_machinetype(econet_station, &imm_reply, &imm_reply_len))
+    {
+        ESP_LOGI(TAG, "[%05d] Answering MACHINETYPE for Econet %d.%d from cache",
+                 ack_seq, econet_station->network_id, econet_station->station_id);
+        aun_station->last_tx_result = ECONET_IMM_REPLY;
+        aun_station->last_acked_seq = ack_seq;
+    }
+    else if (is_new)
     {
+        aunbridge_delivery_t *delivery = aunbridge_delivery_alloc(len);
+        if (delivery == NULL)
+        {
+            ESP_LOGW(TAG, "[%05d] Too many frames waiting for Econet. Dropped.", ack_seq);
+            return;
+        }
+
         ESP_LOGI(TAG, "[%05d] Delivering %d byte frame from %d.%d (%s) to Econet %d.%d (P0x%x C0x%x)",
                  ack_seq, len,
                  aun_station->network_id, aun_station->station_id,
@@ -342,46 +801,133 @@ static void _aun_udp_rx_process(econet_station_t *econet_station)
                  econet_station->network_id, econet_station->station_id,
                  hdr.econet_port, hdr.econet_control);
 
-        aun_station->last_tx_result = econet_send(&udp_rx_buffer[2], len, &imm_reply, &imm_reply_len);
-        aun_station->last_acked_seq = ack_seq;
+        // Each AUN station gets its own share of the line. The (N)ACK is
+        // sent once the frame has been delivered.
+        memcpy(delivery->frame, &udp_rx_buffer[2], len);
+        memcpy(delivery->hdr, &hdr, sizeof(hdr));
+        delivery->done = _aun_delivered;
+        delivery->from = aun_station;
+        delivery->to = econet_station;
+        delivery->tx_source = aun_station->tx_source;
+        aun_station->deliveries++;
+        aun_station->delivering_seq = ack_seq;
+        aunbridge_deliver(delivery);
+        return;
     }
     else
     {
         ESP_LOGI(TAG, "[%05d] Re-acknowledging duplicate (Econet ack was %d)", ack_seq, aun_station->last_tx_result);
     }
 
-    // Send AUN ack/nack
-    switch (aun_station->last_tx_result)
-    {
-    case ECONET_ACK:
-        hdr.transaction_type = AUN_TYPE_ACK;
-        aunbridge_stats.tx_ack_count++;
-        break;
-    case ECONET_IMM_REPLY:
-        hdr.transaction_type = AUN_TYPE_IMM_REPLY;
-        aunbridge_stats.tx_ack_count++;
-        break;
-    default:
-        hdr.transaction_type = AUN_TYPE_NACK;
-        aunbridge_stats.tx_nack_count++;
-    }
+    _aun_send_ack(econet_station, aun_station, hdr, aun_station->last_tx_result, imm_reply, imm_reply_len);
+}
 
-    // Send (N)ACK to calling station at port we have on file
-    struct sockaddr_in dest_addr;
-    dest_addr.sin_addr.s_addr = inet_addr(aun_station->remote_address);
-    dest_addr.sin_family = AF_INET;
-    dest_addr.sin_port = htons(aun_station->udp_port);
-    memcpy(udp_rx_buffer, &hdr, sizeof(hdr));
-    if (imm_reply != NULL)
+/*** Is an earlier delivery from the same sender still in flight? */
+static bool _is_delivery_behind(aunbridge_delivery_t **in_flight, int count, const aunbridge_delivery_t *delivery)
+{
+    for (int i = 0; i < count; i++)
     {
-        memcpy(udp_rx_buffer + sizeof(hdr), imm_reply, imm_reply_len);
+        if (in_flight[i]->tx_source == delivery->tx_source)
+        {
+            return true;
+        }
     }
-    else
+    return false;
+}
+
+/*** Deliver frames from AUN stations and trunks on Econet.
+ *
+ * Each frame is submitted as soon as it comes in, up to ECONET_TX_SLOTS at
+ * a time, so the next is encoded and queued while the one before is on the
+ * line. Results are passed back for answering as they come in, but never
+ * ahead of an earlier frame from the same sender.
+ */
+static void _aun_delivery_task(void *params)
+{
+    aunbridge_delivery_t *in_flight[ECONET_TX_SLOTS]; ///< Oldest first
+    int in_flight_count = 0;
+    aunbridge_delivery_t *delivery;
+
+    for (;;)
     {
-        imm_reply_len = 0;
+        // Submit whatever's come in while there's room
+        while (in_flight_count < ECONET_TX_SLOTS && xQueueReceive(delivery_queue, &delivery, 0) == pdPASS)
+        {
+            delivery->tx_req = econet_tx_submit(delivery->frame, delivery->length, delivery->tx_source, pdMS_TO_TICKS(ECONET_TX_TIMEOUT_MS));
+            delivery->deadline_us = esp_timer_get_time() + ECONET_TX_TIMEOUT_MS * 1000LL;
+            econet_tx_notify_when_done(delivery->tx_req, delivery_task, AUN_DELIVERY_NOTIFY_DONE);
+            in_flight[in_flight_count++] = delivery;
+        }
+
+        // Pass back those that are done, or have taken too long
+        int64_t now_us = esp_timer_get_time();
+        int64_t next_deadline_us = INT64_MAX;
+        int kept = 0;
+        bool is_delivered = false;
+        for (int i = 0; i < in_flight_count; i++)
+        {
+            delivery = in_flight[i];
+            bool is_finished = econet_tx_is_done(delivery->tx_req) || now_us >= delivery->deadline_us;
+            if (!is_finished || _is_delivery_behind(in_flight, kept, delivery))
+            {
+                if (!is_finished && delivery->deadline_us < next_deadline_us)
+                {
+                    next_deadline_us = delivery->deadline_us;
+                }
+                in_flight[kept++] = delivery;
+                continue;
+            }
+
+            // Gives ECONET_SEND_ERROR if it's not done. Give up on it here,
+            // as releasing one that's on the line waits for it to finish and
+            // the UDP RX task mustn't.
+            delivery->result = econet_tx_wait(delivery->tx_req, 0, &delivery->imm_reply, &delivery->imm_reply_len);
+            if (!econet_tx_is_done(delivery->tx_req))
+            {
+                econet_tx_release(delivery->tx_req);
+                delivery->tx_req = NULL;
+            }
+            xQueueSend(delivered_queue, &delivery, portMAX_DELAY);
+            is_delivered = true;
+        }
+        in_flight_count = kept;
+
+        // Wake the UDP RX task to send the (N)ACKs
+        if (is_delivered)
+        {
+            char tmp = 'D';
+            write(rx_udp_ctl_pipe[1], &tmp, sizeof(tmp));
+        }
+
+        TickType_t timeout = portMAX_DELAY;
+        if (next_deadline_us != INT64_MAX)
+        {
+            timeout = pdMS_TO_TICKS((next_deadline_us - now_us + 999) / 1000) + 1;
+        }
+        uint32_t notified = 0;
+        xTaskNotifyWait(0, UINT32_MAX, &notified, timeout);
+        if (!(notified & AUN_DELIVERY_NOTIFY_SHUTDOWN))
+        {
+            continue;
+        }
+
+        // Drop anything not delivered or answered yet
+        for (int i = 0; i < in_flight_count; i++)
+        {
+            _delivery_free(in_flight[i]);
+        }
+        while (xQueueReceive(delivery_queue, &delivery, 0) == pdPASS)
+        {
+            _delivery_free(delivery);
+        }
+        while (xQueueReceive(delivered_queue, &delivery, 0) == pdPASS)
+        {
+            _delivery_free(delivery);
+        }
+        ESP_LOGI(TAG, "AUN: Delivery shutdown");
+        xTaskNotifyGive(shutdown_notify_handle);
+        vTaskDelete(NULL);
     }
-    sendto(econet_station->socket, udp_rx_buffer, sizeof(hdr) + imm_reply_len, 0,
-           (struct sockaddr *)&dest_addr, sizeof(dest_addr));
 }
 
 static void _aun_udp_rx_task(void *params)
@@ -396,15 +942,12 @@ static void _aun_udp_rx_task(void *params)
         FD_ZERO(&rfds);
         FD_SET(rx_udp_ctl_pipe[0], &rfds);
         int max_fd = rx_udp_ctl_pipe[0];
-        for (int i = 0; i < ARRAY_SIZE(econet_stations); i++)
+        for (econet_station_t *station = econet_stations; station != NULL; station = station->next)
         {
-            if (econet_stations[i].is_open)
+            FD_SET(station->socket, &rfds);
+            if (station->socket > max_fd)
             {
-                FD_SET(econet_stations[i].socket, &rfds);
-                if (econet_stations[i].socket > max_fd)
-                {
-                    max_fd = econet_stations[i].socket;
-                }
+                max_fd = station->socket;
             }
         }
         for (int i = 0; i < ARRAY_SIZE(trunks); i++)
@@ -429,19 +972,30 @@ static void _aun_udp_rx_task(void *params)
 
         if (FD_ISSET(rx_udp_ctl_pipe[0], &rfds))
         {
-            ESP_LOGI(TAG, "AUN: RX shutdown");
             char tmp[1];
             read(rx_udp_ctl_pipe[0], &tmp, sizeof(tmp));
-            xTaskNotifyGive(shutdown_notify_handle);
-            vTaskDelete(NULL);
-            continue;
+            if (tmp[0] != 'D')
+            {
+                ESP_LOGI(TAG, "AUN: RX shutdown");
+                xTaskNotifyGive(shutdown_notify_handle);
+                vTaskDelete(NULL);
+                continue;
+            }
+
+            // Answer frames the delivery task has finished with
+            aunbridge_delivery_t *delivery;
+            while (xQueueReceive(delivered_queue, &delivery, 0) == pdPASS)
+            {
+                delivery->done(delivery);
+                _delivery_free(delivery);
+            }
         }
 
-        for (int i = 0; i < ARRAY_SIZE(econet_stations); i++)
+        for (econet_station_t *station = econet_stations; station != NULL; station = station->next)
         {
-            if (FD_ISSET(econet_stations[i].socket, &rfds))
+            if (FD_ISSET(station->socket, &rfds))
             {
-                _aun_udp_rx_process(&econet_stations[i]);
+                _aun_udp_rx_process(station);
             }
         }
 
@@ -469,43 +1023,42 @@ static void _aun_udp_rx_task(void *params)
 
 static void _setup_aun_station(void *ctx, const config_aun_station_t *cfg)
 {
-    aun_station_t *station = NULL;
-    for (int i = 0; i < ARRAY_SIZE(aun_stations); i++)
+    if (aun_station_by_id[cfg->station_id] != NULL)
     {
-        if (aun_stations[i].station_id == 0)
-        {
-            station = &aun_stations[i];
-            break;
-        }
+        ESP_LOGE(TAG, "AUN station %d is configured more than once.", cfg->station_id);
+        return;
     }
+
+    aun_station_t *station = calloc(1, sizeof(aun_station_t));
     if (station == NULL)
     {
-        ESP_LOGE(TAG, "No free AUN station slots.");
+        ESP_LOGE(TAG, "No memory for AUN station %d.", cfg->station_id);
         return;
     }
 
     snprintf(station->remote_address, sizeof(station->remote_address), "%s", cfg->remote_address);
+    station->remote_ip = inet_addr(cfg->remote_address);
     station->station_id = cfg->station_id;
     station->network_id = cfg->network_id;
     station->udp_port = cfg->udp_port;
+    station->tx_source = aun_station_count % AUN_TX_SOURCES;
     station->last_acked_seq = UINT32_MAX;
     station->last_tx_result = ECONET_NACK;
+    station->peer.send = _aun_station_send;
+    station->peer.ctx = station;
+    snprintf(station->peer.name, sizeof(station->peer.name), "%s:%d", station->remote_address, station->udp_port);
+
+    station->next = aun_stations;
+    aun_stations = station;
+    aun_station_by_id[cfg->station_id] = station;
+    aun_station_count++;
 }
 
 static void _setup_econet_station(void *ctx, const config_econet_station_t *cfg)
 {
-    econet_station_t *station = NULL;
-    for (int i = 0; i < ARRAY_SIZE(econet_stations); i++)
-    {
-        if (!econet_stations[i].is_open)
-        {
-            station = &econet_stations[i];
-            break;
-        }
-    }
-    if (station == NULL)
+    if (econet_station_by_id[cfg->station_id] != NULL)
     {
-        ESP_LOGE(TAG, "Failed to add station %d. No free slots.", cfg->station_id);
+        ESP_LOGE(TAG, "Failed to add station %d. Already configured.", cfg->station_id);
         return;
     }
 
@@ -530,13 +1083,24 @@ static void _setup_econet_station(void *ctx, const config_econet_station_t *cfg)
         return;
     }
 
+    econet_station_t *station = calloc(1, sizeof(econet_station_t));
+    if (station == NULL)
+    {
+        ESP_LOGE(TAG, "Failed to add station %d. No memory.", cfg->station_id);
+        close(sock);
+        return;
+    }
+
     ESP_LOGI(TAG, "Added Econet station %d on port %d", cfg->station_id, cfg->local_udp_port);
 
     station->station_id = cfg->station_id;
     station->network_id = 0;
     station->local_udp_port = cfg->local_udp_port;
     station->socket = sock;
-    station->is_open = true;
+
+    station->next = econet_stations;
+    econet_stations = station;
+    econet_station_by_id[cfg->station_id] = station;
 }
 
 void aunbridge_shutdown(void)
@@ -553,47 +1117,114 @@ void aunbridge_shutdown(void)
         char tmp = 0;
         write(rx_udp_ctl_pipe[1], &tmp, sizeof(tmp));
         ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+
+        // Shut down delivery to Econet, dropping anything still waiting
+        xTaskNotify(delivery_task, AUN_DELIVERY_NOTIFY_SHUTDOWN, eSetBits);
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+
+        // Shut down forwarding to AUN, dropping anything still waiting
+        xTaskNotify(aun_tx_task, AUN_TX_NOTIFY_SHUTDOWN, eSetBits);
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
         is_running = false;
     }
 }
 
+static void _add_peer(aunbridge_peer_t *peer)
+{
+    peer->head = 0;
+    peer->count = 0;
+    peer->ack_head = 0;
+    peer->ack_tail = 0;
+    peer->srtt_us = 0;
+    peer->rttvar_us = 0;
+    peer->rto_us = AUN_TX_RTO_INITIAL_MS * 1000 < tx_rto_cap_us ? AUN_TX_RTO_INITIAL_MS * 1000 : tx_rto_cap_us;
+    peer->rtt_max_us = 0;
+    peer->retry_count = 0;
+
+    peer->next = peers;
+    peers = peer;
+}
+
+void aunbridge_foreach_peer(aunbridge_peer_iterator iter, void *ctx)
+{
+    xSemaphoreTake(peers_lock, portMAX_DELAY);
+    for (aunbridge_peer_t *peer = peers; peer != NULL; peer = peer->next)
+    {
+        iter(ctx, peer);
+    }
+    xSemaphoreGive(peers_lock);
+}
+
 void aunbridge_reconfigure(void)
 {
     // Shut down receivers so we can safely modify state
     aunbridge_shutdown();
+    xSemaphoreTake(peers_lock, portMAX_DELAY);
+    peers = NULL;
 
     // Clear down stations
-    for (int i = 0; i < ARRAY_SIZE(econet_stations); i++)
+    while (econet_stations != NULL)
     {
-        if (econet_stations[i].is_open)
-        {
-            closesocket(econet_stations[i].socket);
-            econet_stations[i].is_open = false;
-        }
-        econet_stations[i].station_id = 0;
+        econet_station_t *station = econet_stations;
+        econet_stations = station->next;
+        closesocket(station->socket);
+        free(station);
     }
-    for (int i = 0; i < ARRAY_SIZE(aun_stations); i++)
+    while (aun_stations != NULL)
     {
-        aun_stations[i].station_id = 0;
+        aun_station_t *station = aun_stations;
+        aun_stations = station->next;
+        free(station);
     }
+    free(aun_station_by_addr);
+    aun_station_by_addr = NULL;
+    aun_station_count = 0;
+    memset(econet_station_by_id, 0, sizeof(econet_station_by_id));
+    memset(aun_station_by_id, 0, sizeof(aun_station_by_id));
 
     // Load configuration from config file
     config_foreach_local_station(_setup_econet_station, NULL);
     config_foreach_remote_station(_setup_aun_station, NULL);
+    _index_aun_stations();
 
     // Enable Econet RX for the AUN stations
     econet_rx_clear_bitmaps();
-    for (int i = 0; i < ARRAY_SIZE(aun_stations); i++)
+    econet_tx_ack_cache_invalidate();
+    for (aun_station_t *station = aun_stations; station != NULL; station = station->next)
     {
-        if (aun_stations[i].station_id != 0)
-        {
-            econet_rx_enable_station(aun_stations[i].station_id);
-        }
+        econet_rx_enable_station(station->station_id);
     }
 
     trunk_reconfigure();
 
+    // Everything packets from Econet can be forwarded to
+    uint32_t rto_cap_ms = config_get_aun_rto_cap_ms();
+    if (rto_cap_ms == 0)
+    {
+        rto_cap_ms = AUN_TX_RTO_CAP_MS;
+    }
+    else if (rto_cap_ms < AUN_TX_RTO_MIN_MS)
+    {
+        rto_cap_ms = AUN_TX_RTO_MIN_MS;
+    }
+    tx_rto_cap_us = rto_cap_ms * 1000;
+    for (aun_station_t *station = aun_stations; station != NULL; station = station->next)
+    {
+        _add_peer(&station->peer);
+    }
+    for (int i = 0; i < ARRAY_SIZE(trunks); i++)
+    {
+        if (trunks[i].is_open)
+        {
+            _add_peer(&trunks[i].peer);
+        }
+    }
+    xSemaphoreGive(peers_lock);
+
     // Start receivers
+    delivery_count = 0;
+    xTaskCreate(_aun_delivery_task, "aun_delivery", 4096, NULL, 1, &delivery_task);
+    xTaskCreate(_aun_tx_task, "aun_tx", 4096, NULL, 1, &aun_tx_task);
     xTaskCreate(_aun_udp_rx_task, "aun_udp_rx", 4096, NULL, 1, NULL);
     xTaskCreate(_aun_econet_rx_task, "aun_econet_rx", 4096, NULL, 1, NULL);
     is_running = true;
@@ -601,7 +1232,10 @@ void aunbridge_reconfigure(void)
 
 void aunbrige_start(void)
 {
-    ack_queue = xQueueCreate(10, sizeof(uint32_t));
+    aun_tx_queue = xQueueCreate(4, sizeof(econet_rx_packet_t));
+    peers_lock = xSemaphoreCreateMutex();
+    delivery_queue = xQueueCreate(AUN_DELIVERIES, sizeof(aunbridge_delivery_t *));
+    delivered_queue = xQueueCreate(AUN_DELIVERIES, sizeof(aunbridge_delivery_t *));
     pipe(rx_udp_ctl_pipe); // Ugh. I feel dirty using sockets on embedded!
     is_running = false;
     aunbridge_reconfigure();
@@ -13,6 +13,7 @@
 #pragma once
 
 #include <stdint.h>
+#include <stdatomic.h>
 
 #include "econet.h"
 
@@ -49,13 +50,101 @@ typedef struct
     uint32_t rx_unknown_count;
     uint32_t rx_bridge_control;
     uint32_t rx_broadcast_count;
+    uint32_t imm_cache_hit_count;  ///< MACHINETYPE answered from the cache
+    uint32_t imm_cache_miss_count; ///< MACHINETYPE that had to go on the line
+    uint32_t rx_drop_count;        ///< Frames for Econet dropped with too many waiting to be delivered
 } aunbridge_stats_t;
 
+// Packets from Econet are held per peer (AUN station or trunk) until they're
+// ACKed or given up on, so a slow or dead peer only holds up its own traffic.
+#define AUN_TX_WINDOW 1        ///< Packets in flight to one peer at once
+#define AUN_TX_BACKLOG 4       ///< Packets held for one peer, including those in flight
+#define AUN_TX_TRIES 8         ///< Most times a packet is sent
+#define AUN_TX_GIVE_UP_MS 2000 ///< No resends once this long has passed since the first send
+#define AUN_TX_ACKS 4          ///< ACKs from one peer waiting to be matched. Power of 2.
+
+// Retransmission timeout, worked out per peer from its measured round trip
+// time as in RFC 6298 and doubled on each timeout up to a cap which can be
+// set in the config.
+#define AUN_TX_RTO_INITIAL_MS 500 ///< Until a round trip has been measured
+#define AUN_TX_RTO_MIN_MS 10
+#define AUN_TX_RTO_CAP_MS 2000    ///< Default for the cap
+
+/*** A packet from Econet on its way to a peer */
+typedef struct
+{
+    econet_rx_packet_t pkt; ///< Frame as received. Senders build their headers in its workspace.
+    econet_scout_t scout;   ///< Addresses, control and port, kept as the frame header gets overwritten
+    uint32_t seq;
+    int64_t first_sent_us;
+    int64_t deadline_us;    ///< When to give up waiting for the ACK, 0 if not sent yet
+    uint8_t tries_left;
+    bool is_nacked;         ///< Refused, so send again straight away
+} aunbridge_tx_t;
+
+/*** An ACK or NACK from a peer */
+typedef struct
+{
+    uint32_t seq;
+    bool is_nack;
+} aunbridge_ack_t;
+
+/*** Somewhere packets from Econet are forwarded to, with its own send window */
+typedef struct aunbridge_peer
+{
+    struct aunbridge_peer *next;
+    bool (*send)(struct aunbridge_peer *peer, aunbridge_tx_t *tx); ///< Put a packet on the wire
+    void *ctx;                                ///< Owner of the peer, for send()
+    char name[72];                            ///< Address and port, for logging
+    aunbridge_tx_t backlog[AUN_TX_BACKLOG];   ///< Ring, oldest first. The first AUN_TX_WINDOW are in flight.
+    uint8_t head;
+    uint8_t count;
+    aunbridge_ack_t acks[AUN_TX_ACKS];        ///< Queued by the UDP RX task for the TX task
+    atomic_uchar ack_head;                    ///< Next ACK to match, advanced by the TX task
+    atomic_uchar ack_tail;                    ///< Next free ACK, advanced by the UDP RX task
+    uint32_t srtt_us;                         ///< Smoothed round trip time, 0 until measured
+    uint32_t rttvar_us;                       ///< Round trip time variation
+    uint32_t rto_us;                          ///< Retransmission timeout, including any backoff
+    uint32_t rtt_max_us;
+    uint32_t retry_count;
+} aunbridge_peer_t;
+
+typedef void (*aunbridge_peer_iterator)(void *ctx, const aunbridge_peer_t *peer);
+
+// Frames from AUN stations and trunks are delivered on Econet by a worker
+// task, so the UDP RX task carries on receiving while the line is busy. The
+// worker keeps up to ECONET_TX_SLOTS of them submitted at once.
+#define AUN_DELIVERIES 8 ///< Frames allowed to be waiting for or in delivery
+
+/*** A frame from an AUN station or trunk on its way to Econet.
+ *
+ * Allocate with aunbridge_delivery_alloc(), fill in and pass to
+ * aunbridge_deliver(). Once the worker has finished, done() is called from
+ * the UDP RX task to send the (N)ACK, after which the delivery is freed.
+ */
+typedef struct aunbridge_delivery
+{
+    void (*done)(struct aunbridge_delivery *delivery);
+    void *from;                  ///< AUN station or trunk the frame came from
+    void *to;                    ///< Econet station it's for, if the sender needs it
+    uint8_t hdr[16];             ///< AUN or trunk header to answer with
+    uint8_t tx_source;           ///< Econet TX source to share the line fairly
+    econet_tx_request_t *tx_req;
+    int64_t deadline_us;         ///< Worker gives up waiting for tx_req after this
+    econet_acktype_t result;
+    uint8_t *imm_reply;          ///< Valid until done() returns
+    uint16_t imm_reply_len;
+    uint16_t length;
+    uint8_t frame[];             ///< Econet frame, scout header first
+} aunbridge_delivery_t;
+
 extern aunbridge_stats_t aunbridge_stats;
 extern uint8_t udp_rx_buffer[ECONET_MTU + 64];
 
 void aunbrige_on_econet_frame_rx(uint8_t *data, uint16_t length, void *user_ctx);
 void aunbrige_start(void);
 void aunbridge_reconfigure(void);
-void aunbridge_signal_ack(uint32_t seq);
-bool aunbridge_wait_ack(uint32_t seq);
+void aunbridge_signal_ack(aunbridge_peer_t *peer, uint32_t seq, bool is_nack);
+void aunbridge_foreach_peer(aunbridge_peer_iterator iter, void *ctx);
+aunbridge_delivery_t *aunbridge_delivery_alloc(uint16_t length);
+void aunbridge_deliver(aunbridge_delivery_t *delivery);
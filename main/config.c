@@ -710,6 +710,19 @@ uint8_t config_get_trunk_network(void)
     return 0;
 }
 
+uint32_t config_get_aun_rto_cap_ms(void)
+{
+    cJSON *econet = config_get_econet();
+    if (!econet)
+        return 0;
+
+    cJSON *cap = cJSON_GetObjectItem(econet, "retransmitCapMs");
+    if (cap && cJSON_IsNumber(cap) && cap->valueint > 0)
+        return cap->valueint;
+
+    return 0;
+}
+
 // ==============================================================================
 // Clock Helpers
 // ==============================================================================
@@ -724,6 +737,7 @@ void config_get_econet_clock(config_econet_clock_t *clock)
     clock->duty_pc = 50;
     clock->mode = ECONET_CLOCK_INTERNAL;
     clock->invert_clock = false;
+    clock->turnaround_ms = 20;
 
     cJSON *econet = config_get_econet();
     if (!econet)
@@ -737,6 +751,7 @@ void config_get_econet_clock(config_econet_clock_t *clock)
     cJSON *duty = cJSON_GetObjectItem(clk, "duty");
     cJSON *mode = cJSON_GetObjectItem(clk, "mode");
     cJSON *invert = cJSON_GetObjectItem(clk, "invert");
+    cJSON *turnaround = cJSON_GetObjectItem(clk, "turnaround");
 
     if (freq && cJSON_IsNumber(freq))
         clock->frequency_hz = freq->valueint;
@@ -752,6 +767,9 @@ void config_get_econet_clock(config_econet_clock_t *clock)
 
     if (invert && cJSON_IsBool(invert))
         clock->invert_clock = cJSON_IsTrue(invert);
+
+    if (turnaround && cJSON_IsNumber(turnaround))
+        clock->turnaround_ms = turnaround->valueint;
 }
 
 void config_set_econet_clock(const config_econet_clock_t *clock)
@@ -772,6 +790,7 @@ void config_set_econet_clock(const config_econet_clock_t *clock)
     cJSON_AddStringToObject(clk, "mode",
                             clock->mode == ECONET_CLOCK_INTERNAL ? "internal" : "external");
     cJSON_AddBoolToObject(clk, "invert", clock->invert_clock);
+    cJSON_AddNumberToObject(clk, "turnaround", clock->turnaround_ms);
 
     cJSON_ReplaceItemInObject(econet, "clock", clk);
 }
@@ -37,6 +37,7 @@ typedef struct
     uint32_t duty_pc;
     econet_clock_mode_t mode;
     bool invert_clock;
+    uint32_t turnaround_ms; ///< Allowed for another station to start its reply
 } config_econet_clock_t;
 
 typedef struct
@@ -78,6 +79,7 @@ void config_foreach_remote_station(config_remote_station_iterator iter, void *ct
 void config_foreach_trunk(config_trunk_iterator iter, void *ctx);
 
 uint8_t config_get_trunk_network(void);
+uint32_t config_get_aun_rto_cap_ms(void);
 
 // Internal: Get pointers to config sections
 // This is a shortcut for http_ws.c because it already understands cJSON...
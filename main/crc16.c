@@ -0,0 +1,69 @@
+/*
+ * EconetWiFi
+ * Copyright (c) 2025 Paul G. Banks <https://paulbanks.org/projects/econet>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * See the LICENSE file in the project root for full license information.
+ */
+
+#include "crc16.h"
+
+// Kept in DRAM as the RX deframer uses these from the ISR
+uint16_t DRAM_ATTR crc16_x25_table[4][256];
+
+void crc16_x25_init(void)
+{
+    for (int i = 0; i < 256; i++)
+    {
+        uint16_t crc = i;
+        for (int j = 0; j < 8; j++)
+        {
+            crc = (crc & 0x0001) ? (uint16_t)((crc >> 1) ^ 0x8408)
+                                 : (uint16_t)(crc >> 1);
+        }
+        crc16_x25_table[0][i] = crc;
+    }
+
+    for (int i = 0; i < 256; i++)
+    {
+        for (int t = 1; t < 4; t++)
+        {
+            uint16_t prev = crc16_x25_table[t - 1][i];
+            crc16_x25_table[t][i] = (prev >> 8) ^ crc16_x25_table[0][prev & 0xFF];
+        }
+    }
+}
+
+uint16_t IRAM_ATTR crc16_x25_update_table(uint16_t crc, const uint8_t *data, size_t len)
+{
+    for (size_t i = 0; i < len; i++)
+    {
+        crc = crc16_x25_update(crc, data[i]);
+    }
+    return crc;
+}
+
+uint16_t IRAM_ATTR crc16_x25_update_slice4(uint16_t crc, const uint8_t *data, size_t len)
+{
+    while (len >= 4)
+    {
+        uint32_t x = crc ^ (data[0] | (data[1] << 8));
+        crc = crc16_x25_table[3][x & 0xFF] ^
+              crc16_x25_table[2][x >> 8] ^
+              crc16_x25_table[1][data[2]] ^
+              crc16_x25_table[0][data[3]];
+        data += 4;
+        len -= 4;
+    }
+    return crc16_x25_update_table(crc, data, len);
+}
+
+/*** Compute the frame check sequence over a complete buffer. */
+uint16_t IRAM_ATTR crc16_x25(const uint8_t *data, size_t len)
+{
+    return crc16_x25_update_slice4(CRC16_X25_INIT, data, len) ^ 0xFFFF;
+}
@@ -0,0 +1,41 @@
+/*
+ * EconetWiFi
+ * Copyright (c) 2025 Paul G. Banks <https://paulbanks.org/projects/econet>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * See the LICENSE file in the project root for full license information.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "esp_attr.h"
+#include "utils.h"
+
+// CRC-16/X.25 (reflected polynomial 0x8408) as used for the Econet frame check sequence
+#define CRC16_X25_INIT 0xFFFF
+#define CRC16_X25_RESIDUE 0xF0B8 ///< Register value after a frame and its FCS have been run through
+
+// Slice-by-4 tables. Table 0 is the classic 256-entry byte table.
+extern uint16_t crc16_x25_table[4][256];
+
+void crc16_x25_init(void);
+
+uint16_t crc16_x25_update_table(uint16_t crc, const uint8_t *data, size_t len);
+uint16_t crc16_x25_update_slice4(uint16_t crc, const uint8_t *data, size_t len);
+uint16_t crc16_x25(const uint8_t *data, size_t len);
+
+/*** Run a single byte through the CRC register.
+ *
+ * For the RX deframer, which produces one byte at a time.
+ */
+ALWAYS_INLINE uint16_t crc16_x25_update(uint16_t crc, uint8_t c)
+{
+    return (crc >> 8) ^ crc16_x25_table[0][(crc ^ c) & 0xFF];
+}
@@ -17,6 +17,7 @@
 #include "config.h"
 #define ECONET_PRIVATE_API
 #include "econet.h"
+#include "crc16.h"
 
 #define ECONET_CLK_TMR_CHANNEL LEDC_TIMER_0
 #define ECONET_CLK_PWM_CHANNEL LEDC_CHANNEL_0
@@ -83,6 +84,8 @@ void econet_clock_reconfigure(void)
     }
 
     ESP_ERROR_CHECK(ledc_update_duty(LEDC_LOW_SPEED_MODE, ECONET_CLK_PWM_CHANNEL));
+
+    econet_tx_set_turnaround(clock_cfg.turnaround_ms);
 }
 
 void econet_setup(const econet_config_t *config)
@@ -94,6 +97,7 @@ void econet_setup(const econet_config_t *config)
         econet_cfg.clk_freq_hz = 100000;
     }
 
+    crc16_x25_init();
     econet_clock_setup();
     econet_rx_setup();
     econet_tx_setup();
@@ -14,12 +14,42 @@
 
 #include <stdint.h>
 #include "utils.h"
+#include "econet_buf.h"
+#include "econet_tx_sched.h"
 #include "hal/gpio_types.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/message_buffer.h"
 
 #define ECONET_MTU 8192
 #define ECONET_RX_BUFFER_WORKSPACE 32
+#define ECONET_TX_TIMEOUT_MS 10000 ///< Longest wait for a free TX slot or a transaction to finish
+
+// ACK turnaround histogram. Bucket n counts ACKs finished less than
+// 2^n * ECONET_ACK_HIST_UNIT_US after the end of the frame being ACKed.
+#define ECONET_ACK_HIST_BUCKETS 8
+#define ECONET_ACK_HIST_UNIT_US 125
+
+// Frame size histogram. Bucket n counts frames (address to CRC inclusive) of
+// length 2^(n+1) up to 2^(n+2)-1 bytes, with bucket 0 holding runts.
+#define ECONET_FRAME_HIST_BUCKETS 12
+
+// Gap between back to back transactions. Bucket n counts transactions
+// started less than 2^n * ECONET_TX_GAP_HIST_UNIT_US after the one before
+// them finished.
+#define ECONET_TX_GAP_HIST_BUCKETS 8
+#define ECONET_TX_GAP_HIST_UNIT_US 125
+
+// Phases of a TX transaction, each timed from the end of the one before.
+// Bucket n counts phases taking less than 2^n * ECONET_TX_PHASE_HIST_UNIT_US.
+#define ECONET_TX_PHASE_ENCODE 0    ///< Submitted (including any wait for a TX slot) to encoded
+#define ECONET_TX_PHASE_QUEUE 1     ///< Posted to picked to send with the line idle
+#define ECONET_TX_PHASE_SCOUT 2     ///< Scout going out
+#define ECONET_TX_PHASE_SCOUT_ACK 3 ///< Scout sent to its ACK or immediate reply
+#define ECONET_TX_PHASE_DATA 4      ///< Data frame going out
+#define ECONET_TX_PHASE_DATA_ACK 5  ///< Data frame sent to its ACK
+#define ECONET_TX_PHASES 6
+#define ECONET_TX_PHASE_HIST_BUCKETS 12
+#define ECONET_TX_PHASE_HIST_UNIT_US 16
 
 // Econet immediate mode packet types.
 // Thanks to JGH for info (https://mdfs.net/Docs/Comp/Econet/Specs/Packets)
@@ -84,7 +114,7 @@ typedef struct
 
 typedef struct
 {
-    uint32_t rx_frame_count;
+    uint32_t rx_frame_count; ///< Good frames addressed to us
     uint32_t rx_crc_fail_count;
     uint32_t rx_short_frame_count;
     uint32_t rx_abort_count;
@@ -93,6 +123,38 @@ typedef struct
     uint32_t rx_nack_count;
     uint32_t tx_frame_count;
     uint32_t tx_ack_count;
+    uint32_t rx_isr_count;            ///< RX DMA chunks delivered
+    uint32_t rx_ack_latency_count;    ///< ACKs triggered from RX
+    uint32_t rx_ack_latency_total_us; ///< Sum of closing flag to ACK trigger latencies
+    uint32_t rx_ack_latency_max_us;   ///< Worst closing flag to ACK trigger latency
+    uint32_t rx_filtered_count;       ///< Frames for other stations, dropped after the address
+    uint32_t rx_no_buffer_count;      ///< Frames for us dropped because the buffer pool was empty
+    uint32_t rx_unpaired_count;       ///< Scouts dropped without a matching data frame
+    uint32_t rx_idle_count;           ///< Times the line went idle
+    uint32_t rx_idle_signal_cycles;   ///< CPU cycles spent signalling the line going idle
+    uint32_t tx_ack_fast_count;       ///< ACKs sent straight from the RX ISR
+    uint32_t tx_ack_turnaround_hist[ECONET_ACK_HIST_BUCKETS]; ///< Frame end to ACK end
+    uint32_t tx_ack_cache_hit_count;  ///< ACKs sent from an already encoded frame
+    uint32_t tx_ack_cache_miss_count; ///< ACKs that had to be encoded
+    uint64_t rx_line_busy_bits;       ///< Bit times the line wasn't idle
+    uint64_t rx_line_idle_bits;       ///< Bit times the line was idle
+    uint32_t rx_line_util_pc;         ///< Line utilisation over the last second
+    uint32_t rx_line_util_peak_pc;    ///< Highest one second line utilisation
+    uint32_t rx_frame_len_hist[ECONET_FRAME_HIST_BUCKETS]; ///< Every frame seen on the line, ours or not
+    uint32_t tx_underrun_count;       ///< Frames cut short because the next chunk wasn't chained in time
+    uint32_t tx_gap_hist[ECONET_TX_GAP_HIST_BUCKETS]; ///< Previous transaction end to next scout start
+    uint32_t tx_queue_depth[ECONET_TX_CLASSES];         ///< Waiting to be sent, per scheduler class
+    uint32_t tx_queue_depth_peak[ECONET_TX_CLASSES];
+    uint32_t tx_queue_wait_count[ECONET_TX_CLASSES];    ///< Taken off the queue to be sent
+    uint64_t tx_queue_wait_total_us[ECONET_TX_CLASSES]; ///< Sum of queued to taken times
+    uint32_t tx_queue_wait_max_us[ECONET_TX_CLASSES];
+    uint32_t tx_scout_retry_count;     ///< Scouts sent again after backing off
+    uint32_t tx_scout_collision_count; ///< Unanswered scouts where the receiver saw line errors
+    uint32_t tx_scout_defer_count;     ///< Backoffs started over because the line was taken
+    uint32_t tx_scout_giveup_count;    ///< Scouts still unanswered after every attempt
+    uint32_t tx_phase_hist[ECONET_TX_PHASES][ECONET_TX_PHASE_HIST_BUCKETS];
+    uint32_t tx_phase_max_us[ECONET_TX_PHASES];
+    uint32_t rx_bit_clock_hz;          ///< Bit clock measured over the last utilisation window
 } econet_stats_t;
 
 typedef struct
@@ -103,6 +165,14 @@ typedef struct
     uint8_t src_net;
 } econet_hdr_t;
 
+/*** Line state as seen by the receiver */
+typedef enum
+{
+    ECONET_LINE_IDLE,  ///< At least 15 consecutive 1 bits
+    ECONET_LINE_BUSY,  ///< Line in use but no flags seen (e.g. we're transmitting)
+    ECONET_LINE_FRAME, ///< Receiving flags or a frame
+} econet_line_state_t;
+
 typedef struct
 {
     econet_hdr_t hdr;
@@ -111,11 +181,44 @@ typedef struct
     uint8_t data[0];
 } econet_scout_t;
 
+// Requests that can be outstanding at once
+#define ECONET_TX_SLOTS 8
+
+/*** Handle for a frame submitted with econet_tx_submit().
+ *
+ * Any number of tasks can submit frames, with up to ECONET_TX_SLOTS
+ * outstanding at once, so econet_tx_submit() blocks for up to timeout until
+ * there's room.
+ * Immediate operations are sent in the order they were submitted, ahead of
+ * data frames. Data frames are shared out fairly between sources, each
+ * sender using its own source id below ECONET_TX_SOURCES, and are sent in
+ * order for any one source. The frame is sent from the
+ * caller's buffer, which must stay put until econet_tx_release() returns.
+ * Wait for the result with econet_tx_wait(), poll econet_tx_is_done() or
+ * have econet_tx_notify_when_done() wake the task.
+ * The result and any immediate reply stay valid until econet_tx_release(),
+ * which must always be called. Releasing a request that isn't done gives up
+ * on it: if it hasn't gone on the line yet it's dropped, otherwise release
+ * waits for the transaction to finish. Submitting returns NULL on failure.
+ * The other calls accept NULL and treat it as a request that failed to send.
+ */
+typedef struct econet_tx_request econet_tx_request_t;
+
+/*** Received packet types.
+ *
+ * 'P' Scout and data transaction. data holds the data frame, control and
+ *     port come from the scout.
+ * 'F' Single frame (broadcast or immediate), data holds the whole frame.
+ * 'S' Shutdown.
+ */
 typedef struct
 {
-    uint8_t *data;
+    uint8_t *data;     ///< Start of buffer. Frame follows ECONET_RX_BUFFER_WORKSPACE bytes in.
     size_t length;
     char type;
+    uint8_t control;   ///< Scout control byte ('P' only)
+    uint8_t port;      ///< Scout port ('P' only)
+    econet_buf_t *buf; ///< Buffer holding data. Release with econet_rx_packet_free().
 } econet_rx_packet_t;
 
 extern econet_stats_t econet_stats;
@@ -124,11 +227,18 @@ extern QueueHandle_t econet_rx_packet_queue;
 void econet_setup(const econet_config_t *config);
 void econet_clock_reconfigure(void);
 void econet_start(void);
-econet_acktype_t econet_send(uint8_t *data, uint16_t length, uint8_t **imm_reply, uint16_t *imm_reply_len);
+econet_tx_request_t *econet_tx_submit(uint8_t *data, uint16_t length, uint8_t source, TickType_t timeout);
+bool econet_tx_is_done(const econet_tx_request_t *req);
+void econet_tx_notify_when_done(econet_tx_request_t *req, TaskHandle_t task, uint32_t notify_bits);
+econet_acktype_t econet_tx_wait(econet_tx_request_t *req, TickType_t timeout, uint8_t **imm_reply, uint16_t *imm_reply_len);
+void econet_tx_release(econet_tx_request_t *req);
 void econet_rx_clear_bitmaps(void);
 void econet_rx_enable_station(uint8_t station_id);
 void econet_rx_set_networks(bitmap256_t *nets);
 void econet_rx_shutdown(void);
+void econet_rx_packet_free(econet_rx_packet_t *pkt);
+econet_line_state_t econet_rx_line_state(void);
+void econet_tx_ack_cache_invalidate(void);
 
 ALWAYS_INLINE void econet_swap_addresses(econet_hdr_t *hdr)
 {
@@ -153,7 +263,9 @@ void econet_rx_start(void);
 void econet_tx_setup(void);
 void econet_tx_start(void);
 bool econet_rx_is_idle(void);
+uint32_t econet_rx_bit_clock_hz(void);
 void econet_tx_pre_go(void);
+void econet_tx_set_turnaround(uint32_t turnaround_ms);
 
 typedef enum
 {
@@ -173,6 +285,21 @@ typedef struct
     uint8_t flags;
     uint8_t *imm_reply;
     size_t imm_length;
+    econet_buf_t *imm_buf; ///< Buffer holding imm_reply, owned by whoever takes the command
+    int64_t queued_us;     ///< Set by econet_tx_post_from_isr()
 } econet_tx_command_t;
 
+// TX task notification bits. Commands are passed on tx_command_queue with
+// ECONET_TX_NOTIFY_CMD set to wake the task; the line going idle, an ACK
+// sent from the RX ISR finishing, progress of a streamed frame and a TX slot
+// being queued are only notifications.
+#define ECONET_TX_NOTIFY_CMD (1 << 0)
+#define ECONET_TX_NOTIFY_IDLE (1 << 1)
+#define ECONET_TX_NOTIFY_ACK_DONE (1 << 2)
+#define ECONET_TX_NOTIFY_STREAM (1 << 3)
+#define ECONET_TX_NOTIFY_SLOT (1 << 4)
+
+bool econet_tx_post_from_isr(const econet_tx_command_t *cmd, BaseType_t *is_awoken);
+bool econet_tx_ack_from_isr(const econet_hdr_t *ack_hdr, int64_t frame_end_us, BaseType_t *is_awoken);
+
 #endif
@@ -0,0 +1,137 @@
+/*
+ * EconetWiFi
+ * Copyright (c) 2025 Paul G. Banks <https://paulbanks.org/projects/econet>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * See the LICENSE file in the project root for full license information.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "esp_attr.h"
+
+#include "econet.h"
+#include "econet_buf.h"
+
+typedef struct
+{
+    econet_buf_t *bufs;
+    uint32_t count;
+    atomic_uint free_mask; ///< Bit set for each free slot
+} econet_buf_pool_t;
+
+static uint8_t DRAM_ATTR small_storage[ECONET_BUF_SMALL_COUNT][ECONET_RX_BUFFER_WORKSPACE + ECONET_BUF_SMALL_SIZE + ECONET_BUF_TAILROOM] __attribute__((aligned(4)));
+static uint8_t DRAM_ATTR large_storage[ECONET_BUF_LARGE_COUNT][ECONET_RX_BUFFER_WORKSPACE + ECONET_MTU + ECONET_BUF_TAILROOM] __attribute__((aligned(4)));
+static econet_buf_t DRAM_ATTR small_bufs[ECONET_BUF_SMALL_COUNT];
+static econet_buf_t DRAM_ATTR large_bufs[ECONET_BUF_LARGE_COUNT];
+
+static econet_buf_pool_t DRAM_ATTR pools[] = {
+    {.bufs = small_bufs, .count = ECONET_BUF_SMALL_COUNT},
+    {.bufs = large_bufs, .count = ECONET_BUF_LARGE_COUNT},
+};
+
+void econet_buf_setup(void)
+{
+    for (int i = 0; i < ECONET_BUF_SMALL_COUNT; i++)
+    {
+        small_bufs[i] = (econet_buf_t){
+            .data = small_storage[i],
+            .capacity = ECONET_BUF_SMALL_SIZE,
+            .pool = 0,
+            .index = i,
+        };
+    }
+    for (int i = 0; i < ECONET_BUF_LARGE_COUNT; i++)
+    {
+        large_bufs[i] = (econet_buf_t){
+            .data = large_storage[i],
+            .capacity = ECONET_MTU,
+            .pool = 1,
+            .index = i,
+        };
+    }
+    for (int i = 0; i < ARRAY_SIZE(pools); i++)
+    {
+        atomic_store(&pools[i].free_mask, (1u << pools[i].count) - 1);
+    }
+}
+
+static econet_buf_t *IRAM_ATTR _pool_alloc(econet_buf_pool_t *pool)
+{
+    unsigned int free_mask = atomic_load(&pool->free_mask);
+    while (free_mask)
+    {
+        unsigned int slot = __builtin_ctz(free_mask);
+        if (atomic_compare_exchange_weak(&pool->free_mask, &free_mask, free_mask & ~(1u << slot)))
+        {
+            econet_buf_t *buf = &pool->bufs[slot];
+            atomic_store(&buf->refs, 1);
+            return buf;
+        }
+    }
+    return NULL;
+}
+
+/*** Get a buffer from the smallest pool able to hold frame_len bytes.
+ *
+ * Safe to call from the RX ISR. Returns NULL if that pool is exhausted; it's
+ * up to the caller whether to try a larger size or drop the frame.
+ */
+econet_buf_t *IRAM_ATTR econet_buf_alloc(size_t frame_len)
+{
+    return _pool_alloc(&pools[frame_len <= ECONET_BUF_SMALL_SIZE ? 0 : 1]);
+}
+
+void IRAM_ATTR econet_buf_ref(econet_buf_t *buf)
+{
+    atomic_fetch_add(&buf->refs, 1);
+}
+
+void IRAM_ATTR econet_buf_release(econet_buf_t *buf)
+{
+    if (atomic_fetch_sub(&buf->refs, 1) != 1)
+    {
+        return;
+    }
+    if (buf->pool == ECONET_BUF_POOL_HEAP)
+    {
+        free(buf);
+        return;
+    }
+    atomic_fetch_or(&pools[buf->pool].free_mask, 1u << buf->index);
+}
+
+/*** Copy a frame that's to be held for a while out of its pool.
+ *
+ * The pools are small, so frames held on to stop the receiver taking in
+ * more. Moves the frame (frame_len bytes after the workspace) to a buffer
+ * of its own on the heap and drops our reference to the old one. Returns
+ * buf as it is if it's already on the heap, or if there isn't the memory.
+ * Task context only, and the copy must only be released from task context.
+ */
+econet_buf_t *econet_buf_unpool(econet_buf_t *buf, size_t frame_len)
+{
+    if (buf->pool == ECONET_BUF_POOL_HEAP)
+    {
+        return buf;
+    }
+
+    econet_buf_t *copy = malloc(sizeof(econet_buf_t) + ECONET_RX_BUFFER_WORKSPACE + frame_len + ECONET_BUF_TAILROOM);
+    if (copy == NULL)
+    {
+        return buf;
+    }
+    *copy = (econet_buf_t){
+        .data = (uint8_t *)(copy + 1),
+        .capacity = frame_len,
+        .pool = ECONET_BUF_POOL_HEAP,
+    };
+    atomic_store(&copy->refs, 1);
+    memcpy(copy->data, buf->data, ECONET_RX_BUFFER_WORKSPACE + frame_len);
+    econet_buf_release(buf);
+    return copy;
+}
@@ -0,0 +1,47 @@
+/*
+ * EconetWiFi
+ * Copyright (c) 2025 Paul G. Banks <https://paulbanks.org/projects/econet>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * See the LICENSE file in the project root for full license information.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdatomic.h>
+
+// Received frames live in reference counted buffers from one of two pools.
+// Most traffic is scouts, ACKs and short data which fit a small buffer; only
+// a couple of full MTU buffers are kept for bulk transfers.
+//
+// Every buffer has ECONET_RX_BUFFER_WORKSPACE bytes of headroom in front of
+// the frame so that consumers can prepend AUN/trunk headers in place, and
+// ECONET_BUF_TAILROOM bytes after it for encryption padding.
+#define ECONET_BUF_TAILROOM 16
+#define ECONET_BUF_SMALL_SIZE 64
+#define ECONET_BUF_SMALL_COUNT 16
+#define ECONET_BUF_LARGE_COUNT 2
+
+// Pool number of a buffer copied out of its pool onto the heap
+#define ECONET_BUF_POOL_HEAP 2
+
+typedef struct
+{
+    uint8_t *data;       ///< Start of buffer (workspace, then frame)
+    uint16_t capacity;   ///< Frame bytes that fit after the workspace (excluding tailroom)
+    uint8_t pool;        ///< Pool the buffer belongs to
+    uint8_t index;       ///< Slot within the pool
+    atomic_uint refs;    ///< Reference count. Buffer returns to the pool at 0.
+} econet_buf_t;
+
+void econet_buf_setup(void);
+econet_buf_t *econet_buf_alloc(size_t frame_len);
+void econet_buf_ref(econet_buf_t *buf);
+void econet_buf_release(econet_buf_t *buf);
+econet_buf_t *econet_buf_unpool(econet_buf_t *buf, size_t frame_len);
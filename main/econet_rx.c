@@ -18,56 +18,239 @@
 #include "driver/parlio_rx.h"
 #include "driver/gpio.h"
 #include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_cpu.h"
 
 #include "config.h"
 #define ECONET_PRIVATE_API
 #include "econet.h"
+#include "crc16.h"
+#include "hdlc.h"
 #include "utils.h"
 
 #define ECONET_IDLE_BITS 15
-#define ECONET_PACKET_BUFFER_COUNT 3
+
+// Received bits are DMA'd in chunks and deframed a chunk at a time. The chunk
+// length is chosen from the bit clock so that a closing flag is never held
+// in a partly filled chunk for longer than ECONET_RX_FLUSH_US, which bounds
+// the extra delay added before an ACK can be triggered.
+#define ECONET_RX_CHUNK_MAX 32
+#define ECONET_RX_DMA_RING 8
+#define ECONET_RX_FLUSH_US 1000
+
+#define ECONET_RX_UTIL_WINDOW_US 1000000
 
 QueueHandle_t DRAM_ATTR econet_rx_packet_queue;
 
 static parlio_rx_unit_handle_t rx_unit;
 static parlio_rx_delimiter_handle_t rx_delimiter;
-static uint8_t DRAM_ATTR rx_payload_dma_buffer[16];
-
-static uint8_t DRAM_ATTR _raw_shift_in;
-static uint8_t DRAM_ATTR _recv_data_shift_in;
-static uint32_t DRAM_ATTR _recv_data_bit;
-static uint32_t DRAM_ATTR is_frame_active;
-static uint8_t DRAM_ATTR rx_packet_buffers[ECONET_PACKET_BUFFER_COUNT][ECONET_RX_BUFFER_WORKSPACE + ECONET_MTU + 16];
+static uint8_t DRAM_ATTR rx_payload_dma_buffer[ECONET_RX_DMA_RING][ECONET_RX_CHUNK_MAX] __attribute__((aligned(4)));
+static uint32_t rx_chunk_len;
+static uint32_t DRAM_ATTR rx_bit_clock_hz; ///< Expected from the clock config
+
+// Closing flag to ACK trigger latency measurement
+static int64_t DRAM_ATTR rx_chunk_time_us;
+static uint32_t DRAM_ATTR rx_chunk_bits_remaining;
+
+// Line utilisation, measured a byte of line time at a time and folded into
+// the stats once per window
+static int64_t DRAM_ATTR rx_util_window_start_us;
+static uint32_t DRAM_ATTR rx_util_window_bytes;
+static uint32_t DRAM_ATTR rx_util_window_idle_bytes;
+
+// Deframer state carried between bytes. Frames that aren't addressed to us
+// are identified from their first two bytes and then only tracked for the
+// closing flag.
+static hdlc_rx_t DRAM_ATTR rx_hdlc;
+
+// Frames are received into a small pool buffer, moving to a large one if
+// they outgrow it. Until a buffer can be had the address bytes are kept in
+// rx_hdr_scratch so that foreign frames can still be filtered.
+static econet_buf_t *DRAM_ATTR rx_cur_buf;
+static uint8_t DRAM_ATTR rx_hdr_scratch[2];
 static uint8_t *DRAM_ATTR rx_buf;
-static uint32_t DRAM_ATTR rx_packet_buffer_index;
-static uint16_t DRAM_ATTR rx_frame_len;
+static uint16_t DRAM_ATTR rx_buf_capacity;
+
+// Scout waiting for its data frame. The four-way handshake runs without the
+// line going idle, so the scout is dropped if we see idle first.
+static econet_scout_t DRAM_ATTR rx_scout;
+static bool DRAM_ATTR rx_scout_pending;
 static uint16_t DRAM_ATTR rx_crc;
-static volatile uint8_t DRAM_ATTR rx_idle_one_counter;
 
 // These bitmaps determine which stations or networks we answer for on the Econet
 static volatile DRAM_ATTR bitmap256_t rx_station_bitmap;
 static volatile DRAM_ATTR bitmap256_t rx_network_bitmap;
 
-static inline void IRAM_ATTR _begin_frame(void)
+static inline void IRAM_ATTR _set_rx_buf(econet_buf_t *buf)
+{
+    rx_cur_buf = buf;
+    if (buf != NULL)
+    {
+        rx_buf = buf->data + ECONET_RX_BUFFER_WORKSPACE;
+        rx_buf_capacity = buf->capacity;
+    }
+    else
+    {
+        rx_buf = rx_hdr_scratch;
+        rx_buf_capacity = sizeof(rx_hdr_scratch);
+    }
+}
+
+/*** Take ownership of the frame buffer to pass it on */
+static inline econet_buf_t *IRAM_ATTR _take_rx_buf(void)
+{
+    econet_buf_t *buf = rx_cur_buf;
+    _set_rx_buf(NULL);
+    return buf;
+}
+
+/*** Move the frame so far into a bigger buffer.
+ *
+ * Returns false if the pool has nothing suitable, in which case the frame
+ * has to be dropped.
+ */
+static bool IRAM_ATTR _grow_rx_buf(void)
+{
+    econet_buf_t *buf = NULL;
+    if (rx_cur_buf == NULL)
+    {
+        buf = econet_buf_alloc(ECONET_BUF_SMALL_SIZE);
+    }
+    if (buf == NULL)
+    {
+        buf = econet_buf_alloc(ECONET_MTU);
+    }
+    if (buf == NULL)
+    {
+        return false;
+    }
+
+    memcpy(buf->data + ECONET_RX_BUFFER_WORKSPACE, rx_buf, rx_hdlc.frame_len);
+    if (rx_cur_buf != NULL)
+    {
+        econet_buf_release(rx_cur_buf);
+    }
+    _set_rx_buf(buf);
+    return true;
+}
+
+static void IRAM_ATTR _begin_frame(hdlc_rx_t *rx)
+{
+    // Start each frame in a small buffer, keeping a large one only if we
+    // can't get anything else.
+    if (rx_cur_buf == NULL || rx_cur_buf->capacity > ECONET_BUF_SMALL_SIZE)
+    {
+        econet_buf_t *buf = econet_buf_alloc(ECONET_BUF_SMALL_SIZE);
+        if (buf != NULL)
+        {
+            if (rx_cur_buf != NULL)
+            {
+                econet_buf_release(rx_cur_buf);
+            }
+            _set_rx_buf(buf);
+        }
+    }
+
+    rx_crc = CRC16_X25_INIT;
+}
+
+/*** When the closing flag of the current frame went past.
+ *
+ * The flag went past at most rx_chunk_bits_remaining bit times before the
+ * chunk was delivered.
+ */
+static inline int64_t IRAM_ATTR _frame_end_time_us(void)
+{
+    return rx_chunk_time_us - (int64_t)(((uint64_t)rx_chunk_bits_remaining * 1000000) / rx_bit_clock_hz);
+}
+
+/*** Record how long after the closing flag we got round to triggering an ACK */
+static inline void IRAM_ATTR _record_ack_latency(int64_t frame_end_us)
 {
-    _recv_data_bit = 0;
-    rx_frame_len = 0;
-    rx_crc = 0xFFFF;
-    is_frame_active = 1;
+    uint32_t latency_us = (uint32_t)(esp_timer_get_time() - frame_end_us);
+    econet_stats.rx_ack_latency_count++;
+    econet_stats.rx_ack_latency_total_us += latency_us;
+    if (latency_us > econet_stats.rx_ack_latency_max_us)
+    {
+        econet_stats.rx_ack_latency_max_us = latency_us;
+    }
 }
 
-static inline void IRAM_ATTR _complete_frame()
+static inline void IRAM_ATTR _record_frame_len(uint32_t len)
 {
-    is_frame_active = 0;
+    econet_stats.rx_frame_len_hist[log2_bucket(len >> 2, ECONET_FRAME_HIST_BUCKETS)]++;
+}
+
+/*** Fold the utilisation window just finished into the stats */
+static void IRAM_ATTR _close_util_window(void)
+{
+    uint32_t busy_bytes = rx_util_window_bytes - rx_util_window_idle_bytes;
+    econet_stats.rx_line_busy_bits += (uint64_t)busy_bytes * 8;
+    econet_stats.rx_line_idle_bits += (uint64_t)rx_util_window_idle_bytes * 8;
+
+    uint32_t util_pc = rx_util_window_bytes ? (busy_bytes * 100) / rx_util_window_bytes : 0;
+    econet_stats.rx_line_util_pc = util_pc;
+    if (util_pc > econet_stats.rx_line_util_peak_pc)
+    {
+        econet_stats.rx_line_util_peak_pc = util_pc;
+    }
 
-    if (rx_frame_len < 6)
+    // Every bit on the line is clocked in, so the window also measures the
+    // bit clock
+    int64_t window_us = rx_chunk_time_us - rx_util_window_start_us;
+    if (window_us > 0)
+    {
+        econet_stats.rx_bit_clock_hz = ((uint64_t)rx_util_window_bytes * 8 * 1000000) / window_us;
+    }
+
+    rx_util_window_start_us = rx_chunk_time_us;
+    rx_util_window_bytes = 0;
+    rx_util_window_idle_bytes = 0;
+}
+
+static inline bool IRAM_ATTR _is_for_us(uint8_t dst_stn, uint8_t dst_net)
+{
+    return (bm256_test(&rx_station_bitmap, dst_stn) && dst_net == 0x00) || bm256_test(&rx_network_bitmap, dst_net);
+}
+
+/*** Hand the received frame on to the AUN side */
+static inline void IRAM_ATTR _deliver_frame(char type, uint32_t data_len)
+{
+    econet_buf_t *buf = _take_rx_buf();
+    econet_rx_packet_t rx_pkt = {
+        .type = type,
+        .data = buf->data,
+        .length = data_len,
+        .buf = buf,
+        .control = rx_scout.control,
+        .port = rx_scout.port,
+    };
+    if (xQueueSendFromISR(econet_rx_packet_queue, &rx_pkt, NULL) != pdTRUE)
+    {
+        econet_buf_release(buf);
+    }
+}
+
+static inline void IRAM_ATTR _drop_pending_scout(void)
+{
+    if (rx_scout_pending)
+    {
+        rx_scout_pending = false;
+        econet_stats.rx_unpaired_count++;
+    }
+}
+
+static void IRAM_ATTR _complete_frame(hdlc_rx_t *rx)
+{
+    _record_frame_len(rx->frame_len);
+    if (rx->frame_len < 6)
     {
         econet_stats.rx_short_frame_count++;
         return;
     }
 
     // Check CRC residual
-    if (rx_crc != 0xF0B8)
+    if (rx_crc != CRC16_X25_RESIDUE)
     {
         econet_stats.rx_crc_fail_count++;
         return;
@@ -75,186 +258,200 @@ static inline void IRAM_ATTR _complete_frame()
 
     econet_stats.rx_frame_count++;
 
-    // Is this for us?
-    if ((bm256_test(&rx_station_bitmap, rx_buf[0]) && rx_buf[1] == 0x00) || bm256_test(&rx_network_bitmap, rx_buf[1]))
+    uint32_t data_len = rx->frame_len - 2;
+
+    BaseType_t is_awoken = true;
+    if (data_len > 4)
     {
+        // Normal data packet
+        if (!tx_is_awaiting_imm_reply)
+        {
+            bool is_broadcast = rx_buf[0] == 255 || rx_buf[1] == 255;
 
-        uint32_t data_len = rx_frame_len - 2;
+            // The frame following a scout is its data, as long as it's
+            // from the same station.
+            bool is_data = rx_scout_pending && memcmp(rx_buf, &rx_scout.hdr, sizeof(econet_hdr_t)) == 0;
+            if (!is_data)
+            {
+                _drop_pending_scout();
+            }
 
-        BaseType_t is_awoken = true;
-        if (data_len > 4)
-        {
-            // Normal data packet
-            if (!tx_is_awaiting_imm_reply)
+            // Trigger ACK immediately if not broadcast
+            if (!is_broadcast)
             {
-                // Trigger ACK immediately if not broadcast
-                if (rx_buf[0] != 255 && rx_buf[1] != 255)
+                int64_t frame_end_us = _frame_end_time_us();
+                econet_hdr_t ack_hdr = {
+                    .dst_stn = rx_buf[2],
+                    .dst_net = rx_buf[3],
+                    .src_stn = rx_buf[0],
+                    .src_net = rx_buf[1]};
+                if (!econet_tx_ack_from_isr(&ack_hdr, frame_end_us, &is_awoken))
                 {
+                    // Leave it to the TX task
                     econet_tx_command_t ack_cmd = {
                         .cmd = 'A',
-                        .dst_stn = rx_buf[2],
-                        .dst_net = rx_buf[3],
-                        .src_stn = rx_buf[0],
-                        .src_net = rx_buf[1]};
-                    xQueueSendFromISR(tx_command_queue, &ack_cmd, &is_awoken);
+                        .dst_stn = ack_hdr.dst_stn,
+                        .dst_net = ack_hdr.dst_net,
+                        .src_stn = ack_hdr.src_stn,
+                        .src_net = ack_hdr.src_net};
+                    econet_tx_post_from_isr(&ack_cmd, &is_awoken);
                     econet_tx_pre_go();
                 }
+                _record_ack_latency(frame_end_us);
+            }
 
-                // Deliver packet to outgoing queue
-                econet_rx_packet_t rx_pkt = {
-                    .type = 'P',
-                    .data = &rx_packet_buffers[rx_packet_buffer_index][0],
-                    .length = data_len,
-                };
-                xQueueSendFromISR(econet_rx_packet_queue, &rx_pkt, NULL);
+            if (is_data)
+            {
+                // Deliver the whole transaction to the outgoing queue
+                rx_scout_pending = false;
+                _deliver_frame('P', data_len);
             }
-            else
-            { // IMMediate reply
-                econet_tx_command_t imm_reply_cmd = {
-                    .cmd = 'R',
-                    .imm_reply = &rx_packet_buffers[rx_packet_buffer_index][0],
-                    .imm_length = data_len,
-                };
-                xQueueSendFromISR(tx_command_queue, &imm_reply_cmd, &is_awoken);
+            else if (data_len == sizeof(econet_scout_t) && !is_broadcast)
+            {
+                // Scout. Hold on to it until the data arrives.
+                memcpy(&rx_scout, rx_buf, sizeof(econet_scout_t));
+                rx_scout_pending = true;
             }
-
-            rx_packet_buffer_index++;
-            if (rx_packet_buffer_index >= ECONET_PACKET_BUFFER_COUNT)
+            else
             {
-                rx_packet_buffer_index = 0;
+                // Broadcast or immediate frame, complete in itself
+                _deliver_frame('F', data_len);
             }
-            rx_buf = &rx_packet_buffers[rx_packet_buffer_index][ECONET_RX_BUFFER_WORKSPACE];
-
         }
         else
-        {
-            // Received ACK, let TX side know
-            econet_stats.rx_ack_count++;
-
-            econet_tx_command_t ack_cmd = {
-                .cmd = 'a',
-                .dst_stn = rx_buf[0],
-                .dst_net = rx_buf[1],
-                .src_stn = rx_buf[2],
-                .src_net = rx_buf[3]};
-            xQueueSendFromISR(tx_command_queue, &ack_cmd, &is_awoken);
-        }
-
-        portYIELD_FROM_ISR(is_awoken);
-    }
-}
-
-static inline void IRAM_ATTR _clk_bit(uint8_t c)
-{
-
-    if (c && !tx_is_in_progress)
-    {
-        if (rx_idle_one_counter < ECONET_IDLE_BITS)
-        {
-            rx_idle_one_counter++;
-            if (rx_idle_one_counter == ECONET_IDLE_BITS)
+        { // IMMediate reply
+            econet_buf_t *buf = _take_rx_buf();
+            econet_tx_command_t imm_reply_cmd = {
+                .cmd = 'R',
+                .imm_reply = buf->data,
+                .imm_length = data_len,
+                .imm_buf = buf,
+            };
+            if (!econet_tx_post_from_isr(&imm_reply_cmd, &is_awoken))
             {
-                econet_rx_packet_t rx_pkt = {
-                    .type = 'I',
-                };
-                xQueueSendFromISR(econet_rx_packet_queue, &rx_pkt, NULL);
-
-                econet_tx_command_t idle_cmd = {
-                    .cmd = 'I',
-                };
-                xQueueSendFromISR(tx_command_queue, &idle_cmd, NULL);
-                portYIELD_FROM_ISR(pdTRUE);
+                econet_buf_release(buf);
             }
         }
     }
     else
     {
-        rx_idle_one_counter = 0;
+        // Received ACK, let TX side know
+        econet_stats.rx_ack_count++;
+
+        econet_tx_command_t ack_cmd = {
+            .cmd = 'a',
+            .dst_stn = rx_buf[0],
+            .dst_net = rx_buf[1],
+            .src_stn = rx_buf[2],
+            .src_net = rx_buf[3]};
+        econet_tx_post_from_isr(&ack_cmd, &is_awoken);
     }
 
-    _raw_shift_in = (_raw_shift_in << 1) | c;
+    portYIELD_FROM_ISR(is_awoken);
+}
 
-    // Search for flag
-    if (_raw_shift_in == 0x7e)
+static bool IRAM_ATTR _add_byte(hdlc_rx_t *rx, uint8_t c)
+{
+    if (rx->frame_len == rx_buf_capacity && !_grow_rx_buf())
     {
-        if (is_frame_active == 0)
-        {
-            _begin_frame();
-        }
-        else
-        {
-            // If, after getting a flag, we've got something other than a flag then we
-            // consider this a frame. Otherwise it's just a stream of flags
-            // so we remain at the start of the frame
-            if (rx_frame_len > 1)
-            {
-                _complete_frame();
-            }
-            else
-            {
-                _begin_frame();
-            }
-        }
-        return;
+        econet_stats.rx_no_buffer_count++;
+        return false;
     }
 
-    if (is_frame_active == 0)
+    rx_crc = crc16_x25_update(rx_crc, c);
+    rx_buf[rx->frame_len] = c;
+    return true;
+}
+
+static bool IRAM_ATTR _is_wanted(hdlc_rx_t *rx)
+{
+    if (!_is_for_us(rx_buf[0], rx_buf[1]))
     {
-        return;
+        econet_stats.rx_filtered_count++;
+        return false;
     }
+    return true;
+}
 
-    // Search for ABORT
-    if (_raw_shift_in == 0x7f)
-    {
-        is_frame_active = 0;
+static void IRAM_ATTR _skipped_frame(hdlc_rx_t *rx, uint32_t len)
+{
+    _record_frame_len(len);
+}
 
-        // Don't count glitches as aborts
-        if (rx_frame_len > 1)
-        {
-            econet_stats.rx_abort_count++;
-        }
-        return;
-    }
+static void IRAM_ATTR _aborted_frame(hdlc_rx_t *rx)
+{
+    econet_stats.rx_abort_count++;
+}
 
-    // Bit stuffing
-    if ((_raw_shift_in & 0x3f) == 0x3e)
-    {
-        return;
-    }
+static void IRAM_ATTR _oversize_frame(hdlc_rx_t *rx)
+{
+    econet_stats.rx_oversize_count++;
+}
 
-    // Data
-    _recv_data_shift_in = (_recv_data_shift_in >> 1) | (c << 7); // Data is LSB first
-    _recv_data_bit += 1;
-    if (_recv_data_bit == 8)
+/*** Let the TX task know the line has just gone idle.
+ *
+ * Only TX cares about this (to start a send or to give up waiting for an
+ * ACK), so it gets a notification bit rather than queue items for everyone.
+ */
+static inline void IRAM_ATTR _signal_idle(void)
+{
+    uint32_t start = esp_cpu_get_cycle_count();
+    BaseType_t is_awoken = pdFALSE;
+    if (tx_task != NULL)
     {
+        xTaskNotifyFromISR(tx_task, ECONET_TX_NOTIFY_IDLE, eSetBits, &is_awoken);
+    }
+    econet_stats.rx_idle_count++;
+    econet_stats.rx_idle_signal_cycles += esp_cpu_get_cycle_count() - start;
+    portYIELD_FROM_ISR(is_awoken);
+}
 
-        // Update CRC
-        rx_crc ^= _recv_data_shift_in;
-        for (int j = 0; j < 8; j++)
-        {
-            rx_crc = (rx_crc & 0x0001) ? (uint16_t)((rx_crc >> 1) ^ 0x8408)
-                                       : (uint16_t)(rx_crc >> 1);
-        }
+static void IRAM_ATTR _line_idle(hdlc_rx_t *rx)
+{
+    _drop_pending_scout();
+    _signal_idle();
+}
 
-        rx_buf[rx_frame_len] = _recv_data_shift_in;
-        rx_frame_len += 1;
-        if (rx_frame_len == ECONET_MTU)
-        {
-            is_frame_active = 0;
-            econet_stats.rx_oversize_count++;
-            return;
-        }
-        _recv_data_bit = 0;
+static const hdlc_rx_ops_t DRAM_ATTR rx_hdlc_ops = {
+    .idle_bits = ECONET_IDLE_BITS,
+    .max_len = ECONET_MTU,
+    .begin = _begin_frame,
+    .add_byte = _add_byte,
+    .is_wanted = _is_wanted,
+    .end = _complete_frame,
+    .skipped = _skipped_frame,
+    .aborted = _aborted_frame,
+    .oversize = _oversize_frame,
+    .idle = _line_idle,
+};
+
+static inline void IRAM_ATTR _clk_byte(uint8_t c)
+{
+    bool is_sending = tx_is_in_progress;
+    hdlc_rx_clk_byte(&rx_hdlc, &rx_hdlc_ops, c, is_sending);
+    if (!is_sending && rx_hdlc.idle_ones == ECONET_IDLE_BITS)
+    {
+        rx_util_window_idle_bytes++;
     }
 }
 
 static bool IRAM_ATTR _on_recv_callback(parlio_rx_unit_handle_t rx_unit, const parlio_rx_event_data_t *edata, void *user_data)
 {
-    uint8_t c = *((uint8_t *)edata->data);
-    for (int i = 0; i < 8; i++)
+    const uint8_t *data = edata->data;
+    size_t len = edata->recv_bytes;
+
+    econet_stats.rx_isr_count++;
+    rx_chunk_time_us = esp_timer_get_time();
+    for (size_t i = 0; i < len; i++)
     {
-        _clk_bit((c & 0x80) >> 7);
-        c <<= 1;
+        rx_chunk_bits_remaining = (len - i) * 8;
+        _clk_byte(data[i]);
+    }
+
+    rx_util_window_bytes += len;
+    if (rx_chunk_time_us - rx_util_window_start_us >= ECONET_RX_UTIL_WINDOW_US)
+    {
+        _close_util_window();
     }
 
     return false;
@@ -262,18 +459,53 @@ static bool IRAM_ATTR _on_recv_callback(parlio_rx_unit_handle_t rx_unit, const p
 
 bool econet_rx_is_idle(void)
 {
-    return rx_idle_one_counter == ECONET_IDLE_BITS;
+    return rx_hdlc.idle_ones == ECONET_IDLE_BITS;
+}
+
+econet_line_state_t econet_rx_line_state(void)
+{
+    if (rx_hdlc.idle_ones == ECONET_IDLE_BITS)
+    {
+        return ECONET_LINE_IDLE;
+    }
+    return rx_hdlc.frame_state != HDLC_FRAME_NONE ? ECONET_LINE_FRAME : ECONET_LINE_BUSY;
+}
+
+/*** Bit clock as measured on the line, or as configured until it's been measured */
+uint32_t econet_rx_bit_clock_hz(void)
+{
+    uint32_t clock_hz = econet_stats.rx_bit_clock_hz;
+    return clock_hz ? clock_hz : rx_bit_clock_hz;
 }
 
 void econet_rx_setup(void)
 {
+    hdlc_rx_build_table();
+
     // Load clock configuration to check if we should invert the clock
     config_econet_clock_t clock_cfg;
     config_get_econet_clock(&clock_cfg);
 
+    // Size DMA chunks for the bit clock we expect to see
+    rx_bit_clock_hz = clock_cfg.mode == ECONET_CLOCK_INTERNAL ? clock_cfg.frequency_hz : econet_cfg.clk_freq_hz;
+    if (rx_bit_clock_hz == 0)
+    {
+        rx_bit_clock_hz = econet_cfg.clk_freq_hz;
+    }
+    rx_chunk_len = ((uint64_t)rx_bit_clock_hz * ECONET_RX_FLUSH_US) / (8 * 1000000);
+    if (rx_chunk_len < 1)
+    {
+        rx_chunk_len = 1;
+    }
+    if (rx_chunk_len > ECONET_RX_CHUNK_MAX)
+    {
+        rx_chunk_len = ECONET_RX_CHUNK_MAX;
+    }
+    ESP_LOGI(TAG, "RX DMA chunk is %lu bytes at %lu Hz", rx_chunk_len, rx_bit_clock_hz);
+
     parlio_rx_unit_config_t rx_config = {
-        .trans_queue_depth = sizeof(rx_payload_dma_buffer),
-        .max_recv_size = 1,
+        .trans_queue_depth = ECONET_RX_DMA_RING,
+        .max_recv_size = ECONET_RX_CHUNK_MAX,
         .data_width = 1,
         .clk_src = PARLIO_CLK_SRC_EXTERNAL,
         .ext_clk_freq_hz = econet_cfg.clk_freq_hz,
@@ -304,7 +536,7 @@ void econet_rx_setup(void)
         .sample_edge = clock_cfg.invert_clock ? PARLIO_SAMPLE_EDGE_POS : PARLIO_SAMPLE_EDGE_NEG,
         .bit_pack_order = PARLIO_BIT_PACK_ORDER_MSB,
         .timeout_ticks = 0,
-        .eof_data_len = 1,
+        .eof_data_len = rx_chunk_len,
     };
     ESP_ERROR_CHECK(parlio_new_rx_soft_delimiter(&delimiter_cfg, &rx_delimiter));
 
@@ -314,12 +546,13 @@ void econet_rx_setup(void)
     ESP_ERROR_CHECK(parlio_rx_unit_register_event_callbacks(rx_unit, &cbs, NULL));
 
     econet_rx_packet_queue = xQueueCreate(4, sizeof(econet_rx_packet_t));
-    rx_packet_buffer_index = 0;
-    rx_buf = &rx_packet_buffers[rx_packet_buffer_index][ECONET_RX_BUFFER_WORKSPACE];
+    econet_buf_setup();
+    _set_rx_buf(NULL);
 }
 
 void econet_rx_start(void)
 {
+    rx_util_window_start_us = esp_timer_get_time();
     ESP_ERROR_CHECK(parlio_rx_unit_enable(rx_unit, true));
 
     parlio_receive_config_t rx_cfg = {
@@ -328,14 +561,23 @@ void econet_rx_start(void)
             .partial_rx_en = true,
         }};
 
-    for (int i = 0; i < sizeof(rx_payload_dma_buffer); i++)
+    for (int i = 0; i < ECONET_RX_DMA_RING; i++)
     {
-        ESP_ERROR_CHECK(parlio_rx_unit_receive(rx_unit, &rx_payload_dma_buffer[i], 1, &rx_cfg));
+        ESP_ERROR_CHECK(parlio_rx_unit_receive(rx_unit, rx_payload_dma_buffer[i], rx_chunk_len, &rx_cfg));
     }
 
     ESP_ERROR_CHECK(parlio_rx_soft_delimiter_start_stop(rx_unit, rx_delimiter, true));
 }
 
+void econet_rx_packet_free(econet_rx_packet_t *pkt)
+{
+    if (pkt->buf != NULL)
+    {
+        econet_buf_release(pkt->buf);
+        pkt->buf = NULL;
+    }
+}
+
 void econet_rx_clear_bitmaps(void)
 {
     bm256_reset(&rx_station_bitmap);
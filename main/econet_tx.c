@@ -14,8 +14,12 @@
 #include <string.h>
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "freertos/event_groups.h"
 #include "freertos/message_buffer.h"
 #include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_random.h"
 
 #include "driver/parlio_tx.h"
 #include "driver/gpio.h"
@@ -23,19 +27,14 @@
 #include "config.h"
 #define ECONET_PRIVATE_API
 #include "econet.h"
+#include "crc16.h"
+#include "hdlc.h"
 
-#define ECONET_PARLIO_WIDTH 2
-#define ECONET_FLAGSTREAM_PADDING 6
+#define ECONET_PARLIO_WIDTH HDLC_TX_SYMBOL_BITS
 
-typedef struct
-{
-    uint8_t *bits;
-    size_t bits_size;
-    uint32_t byte_pos;
-    uint32_t bit_pos;
-    uint8_t one_count;
-    uint8_t c;
-} tx_bitstuff_ctx;
+// Send ACKs straight from the RX ISR when the flag fill is armed rather
+// than waiting for the TX task to be scheduled.
+#define ECONET_FAST_ACK 1
 
 TaskHandle_t DRAM_ATTR tx_task = NULL;
 QueueHandle_t DRAM_ATTR tx_command_queue;
@@ -43,220 +42,544 @@ volatile bool DRAM_ATTR tx_is_in_progress;
 volatile bool DRAM_ATTR tx_is_awaiting_imm_reply;
 
 static parlio_tx_unit_handle_t DRAM_ATTR tx_unit;
-static TaskHandle_t DRAM_ATTR tx_sender_task = NULL;
-static econet_acktype_t DRAM_ATTR tx_sent_ack;
 
-// Immediate reply
-static uint8_t *_imm_reply;
-static uint16_t _imm_reply_len;
+// Between frames the line is held with flags by a short flag fill, looped
+// by the PARLIO unit. The fill is armed with the clock stopped and started
+// as soon as we want the line, from the RX ISR for an ACK or from the TX
+// task. Each frame is chained onto the loop as its next buffer, so it
+// follows the flags without a break and the gap ahead of it (e.g. between
+// a scout's ACK and the data frame) is only as long as the fill, plus
+// whatever flags were already in the FIFO. A fill that's too short means a
+// DMA interrupt every few flags. 8 flags puts at most 64 bit times ahead
+// of a frame, and an interrupt every 64 while we hold the line. Once a frame
+// has gone the unit is stopped and the fill re-armed. Must be a whole number
+// of words, so even.
+#define ECONET_TX_FILL_FLAGS 8
+
+typedef enum
+{
+    TX_FILL_STOPPED, ///< Nothing loaded into the unit
+    TX_FILL_ARMED,   ///< Loaded with the clock stopped, ready to go
+    TX_FILL_RUNNING, ///< Flags on the wire, nothing chained on yet
+    TX_FILL_USED,    ///< Frame chained on, unit needs stopping once it's gone
+} tx_fill_state_t;
+
+static uint8_t DRAM_ATTR tx_flag_fill[ECONET_TX_FILL_FLAGS * ECONET_PARLIO_WIDTH] __attribute__((aligned(4)));
+static uint32_t DRAM_ATTR tx_flag_fill_length;
+static volatile tx_fill_state_t DRAM_ATTR tx_fill;
+
+// Data frames are encoded into a ring of small DMA chunks as they go out
+// rather than all at once. The first chunk is encoded up front into the
+// frame's TX slot, the rest are chained onto a PARLIO loop transmission,
+// each one appended from the buffer switched callback as the DMA finishes
+// the one before. The frame is followed by two idle chunks so the closing
+// flag is well clear of the FIFO when the transmission is stopped.
+#define ECONET_TX_CHUNKS 4
+#define ECONET_TX_CHUNK_SIZE 512
+#define ECONET_TX_IDLE_CHUNK_SIZE 32
+#define ECONET_TX_IDLE_CHUNKS 2
+
+typedef enum
+{
+    TX_STREAM_PAYLOAD,
+    TX_STREAM_FCS_LO,
+    TX_STREAM_FCS_HI,
+    TX_STREAM_CLOSE,
+    TX_STREAM_END,
+} tx_stream_step_t;
+
+typedef struct
+{
+    const uint8_t *payload; ///< Next payload byte to encode
+    size_t remaining;       ///< Payload bytes not yet encoded
+    uint16_t fcs;
+    tx_stream_step_t step;
+    hdlc_tx_ctx_t ctx;      ///< Carries the run of 1s and part words between chunks
+    uint8_t next_chunk;
+    uint8_t idle_left;
+    volatile bool is_active;
+    bool is_underrun;       ///< Frame was cut short, see _stream_chain_next()
+} tx_stream_t;
 
-// Outgoing frame
-static uint8_t DRAM_ATTR tx_flag_stream[ECONET_FLAGSTREAM_PADDING * ECONET_PARLIO_WIDTH];
-static uint32_t DRAM_ATTR tx_flag_stream_length;
-static size_t DRAM_ATTR scout_bits_len;
-static uint8_t DRAM_ATTR scout_bits[32 * ECONET_PARLIO_WIDTH];
-static uint8_t DRAM_ATTR tx_bits[ECONET_MTU * ECONET_PARLIO_WIDTH];
-static size_t DRAM_ATTR tx_bits_len;
+static tx_stream_t DRAM_ATTR tx_stream; ///< Frame on the wire
+static uint8_t DRAM_ATTR tx_chunks[ECONET_TX_CHUNKS][ECONET_TX_CHUNK_SIZE] __attribute__((aligned(4)));
+static uint8_t DRAM_ATTR tx_idle_chunk[ECONET_TX_IDLE_CHUNK_SIZE] __attribute__((aligned(4)));
+
+// Each request submitted is encoded into a TX slot, its scout and the start
+// of its data frame, and posted to the TX task, so the next transaction is
+// ready to go while the current one is still on the wire. A slot is the
+// request handle given back to the submitter and stays theirs until
+// econet_tx_release(). There are ECONET_TX_SLOTS of them.
+
+typedef enum
+{
+    TX_SLOT_FREE,
+    TX_SLOT_CLAIMED,   ///< Submitter is encoding into it
+    TX_SLOT_QUEUED,    ///< Waiting to be sent, or backing off before the scout goes again
+    TX_SLOT_SENDING,   ///< TX task is sending it from the submitter's buffer
+    TX_SLOT_DONE,      ///< Result waiting for the submitter
+    TX_SLOT_ABANDONED, ///< Released while backing off, TX task frees it when the backoff ends
+} tx_slot_state_t;
+
+typedef struct econet_tx_request
+{
+    volatile tx_slot_state_t state;
+    econet_tx_sched_entry_t sched; ///< Place in the egress scheduler, kept first
+    uint8_t flags;             ///< econet_tx_command_flags_t
+    uint8_t attempts;          ///< Times the scout has gone unanswered
+    uint16_t reply_len;        ///< Longest expected answer to the scout
+    econet_hdr_t reply_hdr;    ///< Header answers from the addressed station carry
+    int64_t ready_us;          ///< When the slot was posted to the TX task
+    size_t scout_bits_len;
+    uint8_t scout_bits[32 * ECONET_PARLIO_WIDTH] __attribute__((aligned(4)));
+    tx_stream_t stream;        ///< Data frame, encoded as far as the end of chunk0
+    size_t chunk0_len;
+    uint8_t chunk0[ECONET_TX_CHUNK_SIZE] __attribute__((aligned(4)));
+    econet_acktype_t result;
+    TaskHandle_t notify_task;  ///< Notified with notify_bits once done, if set
+    uint32_t notify_bits;
+    uint8_t *imm_reply;
+    uint16_t imm_reply_len;
+    econet_buf_t *imm_reply_buf; ///< Held until the slot is released
+} tx_slot_t;
+
+static tx_slot_t DRAM_ATTR tx_slots[ECONET_TX_SLOTS];
+static portMUX_TYPE tx_slot_lock = portMUX_INITIALIZER_UNLOCKED; ///< Guards slot states and the scheduler
+static SemaphoreHandle_t tx_slot_free_sem; ///< Counts free slots
+static EventGroupHandle_t tx_done_events;  ///< Bit n set while slot n is done
+
+// Egress scheduler, see econet_tx_sched.h. Guarded by tx_slot_lock.
+static econet_tx_sched_t tx_sched;
+
+// A scout that isn't answered is sent again after a random backoff, drawn
+// from a window that doubles with each attempt. The backoff only counts
+// while the line is idle: if the line is taken in the meantime the backoff
+// starts over once it's free again. Everything but ACKs waits behind a scout
+// that's backing off.
+#define ECONET_TX_SCOUT_ATTEMPTS 5
+#define ECONET_TX_BACKOFF_SLOT_BITS 64 ///< About one scout and its ACK
+#define ECONET_TX_BACKOFF_MAX_EXP 4
+
+// ACK and reply waits are worked out from the length of the reply and the
+// bit clock measured by the receiver, plus a configured allowance for the
+// other station to turn round. Immediate replies other than PEEK's are
+// assumed to be no longer than ECONET_TX_IMM_REPLY_LEN.
+#define ECONET_TX_ACK_LEN sizeof(econet_hdr_t)
+#define ECONET_TX_IMM_REPLY_LEN 16
+
+static uint32_t tx_turnaround_us = 20000;
+
+static tx_slot_t *tx_retry_slot;          ///< Scout backing off
+static volatile bool tx_retry_is_due;     ///< Backoff for tx_retry_slot has run out
+static esp_timer_handle_t tx_backoff_timer;
+static int64_t DRAM_ATTR tx_last_done_us;  ///< When the TX task last finished a transaction
+
+// Encoded ACK frames, keyed by header. Entries are only touched with
+// tx_is_in_progress set (TX task) or from the RX ISR when it's clear, so the
+// two never race and an entry is never rewritten while it's being sent.
+#define ECONET_ACK_CACHE_SIZE 16
+#define ECONET_ACK_BITS_SIZE (16 * ECONET_PARLIO_WIDTH)
+typedef struct
+{
+    uint32_t key;        ///< econet_hdr_t as a word
+    uint32_t generation; ///< Valid if equal to ack_cache_generation
+    size_t bits_len;
+    uint8_t bits[ECONET_ACK_BITS_SIZE] __attribute__((aligned(4)));
+} tx_ack_cache_entry_t;
+static tx_ack_cache_entry_t DRAM_ATTR ack_cache[ECONET_ACK_CACHE_SIZE];
+static volatile uint32_t DRAM_ATTR ack_cache_generation = 1;
+
+// ACK sent from the RX ISR
+static volatile bool DRAM_ATTR tx_ack_is_from_isr; ///< tx_stream is an ACK sent from the RX ISR
+static int64_t DRAM_ATTR tx_ack_frame_end_us;      ///< When the frame being ACKed ended
 
 // Custom ParlIO driver
-static volatile bool DRAM_ATTR is_flagstream_queued;
 void parlio_tx_neg_edge(parlio_tx_unit_handle_t tx_unit);
 void parlio_tx_go(parlio_tx_unit_handle_t tx_unit);
 esp_err_t parlio_tx_unit_pretransmit(parlio_tx_unit_handle_t tx_unit, const void *payload, size_t payload_bits, const parlio_transmit_config_t *config);
+esp_err_t parlio_tx_unit_loop_append(parlio_tx_unit_handle_t tx_unit, const void *payload, size_t payload_bits);
+bool parlio_tx_unit_loop_is_late(parlio_tx_unit_handle_t tx_unit);
 void IRAM_ATTR econet_tx_pre_go(void)
 {
     tx_is_in_progress = true;
-    if (is_flagstream_queued)
+    if (tx_fill == TX_FILL_ARMED)
     {
         parlio_tx_go(tx_unit);
-        is_flagstream_queued = false;
+        tx_fill = TX_FILL_RUNNING;
     }
 }
 
-static esp_err_t _queue_flagstream()
+/*** Stop the unit, dropping whatever it's looping */
+static void _stop_tx_unit(void)
+{
+    ESP_ERROR_CHECK(parlio_tx_unit_disable(tx_unit));
+    ESP_ERROR_CHECK(parlio_tx_unit_enable(tx_unit));
+    tx_fill = TX_FILL_STOPPED;
+}
+
+/*** Arm the flag fill, first stopping the unit if a frame has gone */
+static esp_err_t _arm_flag_fill(void)
 {
-    if (is_flagstream_queued)
+    // Leave a frame that's still going, e.g. an ACK sent from the RX ISR.
+    // We're called again once it's done.
+    if (tx_fill == TX_FILL_USED && !tx_stream.is_active)
+    {
+        _stop_tx_unit();
+    }
+    if (tx_fill != TX_FILL_STOPPED)
     {
         return ESP_OK;
     }
-    parlio_transmit_config_t flax_tx_cfg = {
+    parlio_transmit_config_t fill_cfg = {
         .idle_value = 0x00,
+        .flags.loop_transmission = true,
     };
-    esp_err_t ret = parlio_tx_unit_pretransmit(tx_unit, tx_flag_stream, tx_flag_stream_length * 8, &flax_tx_cfg);
-    is_flagstream_queued = true;
+    esp_err_t ret = parlio_tx_unit_pretransmit(tx_unit, tx_flag_fill, tx_flag_fill_length * 8, &fill_cfg);
+    tx_fill = TX_FILL_ARMED;
     return ret;
 }
 
-static inline uint16_t IRAM_ATTR crc16_x25(const uint8_t *data, size_t len)
+size_t IRAM_ATTR _generate_flag_stream(uint8_t *bits, size_t bits_size, int number_of_flags)
 {
-    uint16_t crc = 0xFFFF;
-    for (size_t i = 0; i < len; i++)
+    hdlc_tx_ctx_t stuff_ctx = {
+        .bits = bits,
+        .bits_size = bits_size,
+    };
+    for (int i = 0; i < number_of_flags; i++)
     {
-        crc ^= data[i];
-        for (int j = 0; j < 8; j++)
-        {
-            crc = (crc & 0x0001) ? (uint16_t)((crc >> 1) ^ 0x8408)
-                                 : (uint16_t)(crc >> 1);
-        }
+        hdlc_tx_add_flag(&stuff_ctx);
     }
-    return (uint16_t)(crc ^ 0xFFFF);
+    hdlc_tx_pad_to_word(&stuff_ctx);
+    if (stuff_ctx.byte_pos > stuff_ctx.bits_size)
+    {
+        return 0;
+    }
+    return stuff_ctx.byte_pos;
 }
 
-static inline void IRAM_ATTR _add_raw_bit(tx_bitstuff_ctx *ctx, uint8_t b)
+/*** Encode as much more of the streamed frame as fits into the current chunk.
+ *
+ * Returns the number of bytes used, always a whole number of words. Symbols
+ * that don't make up a whole word are carried over to the next chunk.
+ */
+static size_t IRAM_ATTR _stream_encode(tx_stream_t *stream)
 {
-    ctx->c = ctx->c << ECONET_PARLIO_WIDTH | b;
-    ctx->bit_pos += ECONET_PARLIO_WIDTH;
-    if (ctx->bit_pos >= 8)
+    hdlc_tx_ctx_t *ctx = &stream->ctx;
+
+    // Each step writes at most two words
+    const uint8_t *start = stream->payload;
+    while (stream->remaining && ctx->byte_pos + 8 <= ctx->bits_size)
+    {
+        hdlc_tx_add_byte(ctx, *stream->payload++);
+        stream->remaining--;
+    }
+    if (stream->step == TX_STREAM_PAYLOAD)
+    {
+        stream->fcs = crc16_x25_update_slice4(stream->fcs, start, stream->payload - start);
+        if (stream->remaining)
+        {
+            return ctx->byte_pos;
+        }
+        stream->fcs ^= 0xFFFF;
+        stream->step = TX_STREAM_FCS_LO;
+    }
+
+    while (stream->step != TX_STREAM_END && ctx->byte_pos + 8 <= ctx->bits_size)
     {
-        if (ctx->byte_pos < ctx->bits_size)
+        switch (stream->step)
         {
-            ctx->bits[ctx->byte_pos] = ctx->c;
+        case TX_STREAM_FCS_LO:
+            hdlc_tx_add_byte(ctx, stream->fcs & 0xFF);
+            stream->step = TX_STREAM_FCS_HI;
+            break;
+        case TX_STREAM_FCS_HI:
+            hdlc_tx_add_byte(ctx, stream->fcs >> 8);
+            stream->step = TX_STREAM_CLOSE;
+            break;
+        default:
+            // Flag must be unstuffed, then pad to a word as for a whole frame
+            hdlc_tx_add_flag(ctx);
+            hdlc_tx_pad_to_word(ctx);
+            stream->step = TX_STREAM_END;
+            break;
         }
-        ctx->c = 0;
-        ctx->bit_pos = 0;
-        ctx->byte_pos++;
     }
+    return ctx->byte_pos;
 }
 
-static inline void IRAM_ATTR _add_bit(tx_bitstuff_ctx *ctx, uint8_t bit)
+static size_t IRAM_ATTR _stream_fill(tx_stream_t *stream, uint8_t *chunk)
 {
-    _add_raw_bit(ctx, (bit ? 1 : 0) | 2);
+    stream->ctx.bits = chunk;
+    stream->ctx.byte_pos = 0;
+    return _stream_encode(stream);
 }
 
-static inline void IRAM_ATTR _add_byte_unstuffed(tx_bitstuff_ctx *ctx, uint8_t c)
+/*** Set up a frame to be streamed and encode its first chunk into chunk0.
+ *
+ * Returns the length of the first chunk. The payload must stay put until
+ * the frame has been sent.
+ */
+static size_t _stream_prepare(tx_stream_t *stream, uint8_t *chunk0, const uint8_t *payload, size_t payload_length)
+{
+    *stream = (tx_stream_t){
+        .payload = payload,
+        .remaining = payload_length,
+        .fcs = CRC16_X25_INIT,
+        .step = TX_STREAM_PAYLOAD,
+        .idle_left = ECONET_TX_IDLE_CHUNKS,
+    };
+    stream->ctx.bits = chunk0;
+    stream->ctx.bits_size = ECONET_TX_CHUNK_SIZE;
+    return _stream_encode(stream);
+}
+
+/*** Encode the next chunk of the frame, or pick idle once it's all gone.
+ *
+ * Returns false once there's nothing more to send.
+ */
+static bool IRAM_ATTR _stream_next_chunk(const uint8_t **chunk, size_t *chunk_len)
 {
-    for (int j = 0; j < 8; j++)
+    if (tx_stream.step != TX_STREAM_END)
+    {
+        *chunk = tx_chunks[tx_stream.next_chunk];
+        *chunk_len = _stream_fill(&tx_stream, tx_chunks[tx_stream.next_chunk]);
+        tx_stream.next_chunk = (tx_stream.next_chunk + 1) % ECONET_TX_CHUNKS;
+        return true;
+    }
+    if (tx_stream.idle_left)
     {
-        _add_bit(ctx, c & 1);
-        c >>= 1;
+        tx_stream.idle_left--;
+        *chunk = tx_idle_chunk;
+        *chunk_len = sizeof(tx_idle_chunk);
+        return true;
     }
+    return false;
 }
 
-static inline void IRAM_ATTR _add_byte_stuffed(tx_bitstuff_ctx *ctx, uint8_t c)
+/*** Chain the next chunk on from the DMA callback.
+ *
+ * Returns false once there's nothing more to send, or if the chunk couldn't
+ * be chained in time.
+ */
+static bool IRAM_ATTR _stream_chain_next(void)
 {
+    // Next chunk is the first idle one after the frame data. Idle chunks can
+    // go round more than once, but the last frame chunk mustn't.
+    bool is_frame_end = tx_stream.idle_left == ECONET_TX_IDLE_CHUNKS;
 
-    for (int j = 0; j < 8; j++)
+    const uint8_t *chunk;
+    size_t chunk_len;
+    if (!_stream_next_chunk(&chunk, &chunk_len))
     {
-        uint8_t bit = (c & 1);
-        _add_bit(ctx, bit);
-        c >>= 1;
-        if (bit != 0)
-        {
-            ctx->one_count += 1;
-        }
-        else
-        {
-            ctx->one_count = 0;
-        }
-
-        // Bit stuffing
-        if (ctx->one_count == 5)
-        {
-            _add_bit(ctx, 0);
-            ctx->one_count = 0;
-        }
+        return false;
     }
+    if (parlio_tx_unit_loop_append(tx_unit, chunk, chunk_len * 8) != ESP_OK ||
+        (is_frame_end && parlio_tx_unit_loop_is_late(tx_unit)))
+    {
+        // The DMA has gone round the last chunk again, or is about to, so
+        // the frame's spoilt. Give up on it and let the TX task stop the unit.
+        econet_stats.tx_underrun_count++;
+        tx_stream.is_underrun = true;
+        return false;
+    }
+    return true;
 }
 
-size_t IRAM_ATTR _generate_frame_bits(uint8_t *bits, size_t bits_size, const uint8_t *payload, size_t payload_length)
+static inline void IRAM_ATTR _record_ack_turnaround(void)
 {
+    uint32_t turnaround_us = (uint32_t)(esp_timer_get_time() - tx_ack_frame_end_us);
+    econet_stats.tx_ack_turnaround_hist[log2_bucket(turnaround_us / ECONET_ACK_HIST_UNIT_US, ECONET_ACK_HIST_BUCKETS)]++;
+}
 
-    tx_bitstuff_ctx stuff_ctx = {
-        .bits = bits,
-        .bits_size = bits_size,
-    };
+static bool IRAM_ATTR _on_tx_buffer_switched(parlio_tx_unit_handle_t unit, const parlio_tx_buffer_switched_event_data_t *edata, void *user_ctx)
+{
+    if (!tx_stream.is_active || _stream_chain_next())
+    {
+        return false;
+    }
 
-    // Double flag - this is because the handover from flagstream to
-    // our stream is problematic. Future version we'll customise the
-    // PARLIO driver fully to get rid of this nonsense
-    _add_byte_unstuffed(&stuff_ctx, 0x7e);
-    _add_byte_unstuffed(&stuff_ctx, 0x7e);
+    // Frame and first idle chunk are out. Let the TX task stop the unit.
+    tx_stream.is_active = false;
+    BaseType_t is_awoken = pdFALSE;
+    if (tx_ack_is_from_isr)
+    {
+        tx_ack_is_from_isr = false;
+        _record_ack_turnaround();
+        tx_is_in_progress = false;
+        xTaskNotifyFromISR(tx_task, ECONET_TX_NOTIFY_ACK_DONE, eSetBits, &is_awoken);
+    }
+    else
+    {
+        xTaskNotifyFromISR(tx_task, ECONET_TX_NOTIFY_STREAM, eSetBits, &is_awoken);
+    }
+    return is_awoken;
+}
 
-    for (int i = 0; i < payload_length; i++)
+/*** Chain a frame onto the flag fill and wait for it to go.
+ *
+ * The frame carries on from chunk0 as set up in stream, or is just chunk0
+ * if stream is NULL. Returns false if it was cut short by an underrun.
+ */
+static bool IRAM_ATTR _transmit_frame(const tx_stream_t *stream, const uint8_t *chunk0, size_t chunk0_len)
+{
+    // Keep the RX ISR off the fill, and wait out an ACK it's already sending
+    tx_is_in_progress = true;
+    while (tx_fill == TX_FILL_USED && tx_stream.is_active)
     {
-        _add_byte_stuffed(&stuff_ctx, payload[i]);
+        xTaskNotifyWait(0, ECONET_TX_NOTIFY_ACK_DONE, NULL, 1);
     }
+    _arm_flag_fill();
 
-    // Compute CRC over unstuffed payload bytes
-    uint16_t fcs = crc16_x25(payload, payload_length);
+    if (stream != NULL)
+    {
+        tx_stream = *stream;
+    }
+    else
+    {
+        tx_stream = (tx_stream_t){
+            .step = TX_STREAM_END,
+            .idle_left = ECONET_TX_IDLE_CHUNKS,
+        };
+    }
+    tx_stream.is_active = true;
+
+    // Any idle seen so far is from before this frame
+    ulTaskNotifyValueClear(NULL, ECONET_TX_NOTIFY_IDLE);
 
-    // Emit CRC (16 bits)
-    uint8_t fcs_bytes[2] = {(uint8_t)(fcs & 0xFF), (uint8_t)(fcs >> 8)};
-    for (int i = 0; i < 2; i++)
+    // The DMA callback chains the rest of the frame on as it goes
+    ESP_ERROR_CHECK(parlio_tx_unit_loop_append(tx_unit, chunk0, chunk0_len * 8));
+    econet_tx_pre_go();
+    tx_fill = TX_FILL_USED;
+    while (tx_stream.is_active)
     {
-        _add_byte_stuffed(&stuff_ctx, fcs_bytes[i]);
+        xTaskNotifyWait(0, ECONET_TX_NOTIFY_STREAM, NULL, portMAX_DELAY);
     }
 
-    // Flag must be unstuffed (but still packed)
-    _add_byte_unstuffed(&stuff_ctx, 0x7e);
+    // Stop the idle chunk looping and get ready for the next frame
+    _arm_flag_fill();
+    tx_is_in_progress = false;
+    return !tx_stream.is_underrun;
+}
 
-    // Pad out block so it's on correct boundary
-    // otherwise subequent transactions are screwed up
-    while (stuff_ctx.bit_pos || (stuff_ctx.byte_pos % 4) != 0)
+static void IRAM_ATTR _transmit_bits(const uint8_t *bits, size_t length)
+{
+    _transmit_frame(NULL, bits, length);
+}
+
+/*** Send the data frame set up in a TX slot. Returns false if it was cut short. */
+static bool IRAM_ATTR _transmit_stream(tx_slot_t *slot)
+{
+    return _transmit_frame(&slot->stream, slot->chunk0, slot->chunk0_len);
+}
+
+#define TX_SLOT_DONE_BIT(slot) ((EventBits_t)1 << ((slot) - tx_slots))
+
+static void IRAM_ATTR _count_queued(int tx_class)
+{
+    uint32_t depth = ++econet_stats.tx_queue_depth[tx_class];
+    if (depth > econet_stats.tx_queue_depth_peak[tx_class])
     {
-        _add_raw_bit(&stuff_ctx, 0);
+        econet_stats.tx_queue_depth_peak[tx_class] = depth;
     }
+}
 
-    // Check for overflow
-    if (stuff_ctx.byte_pos > stuff_ctx.bits_size)
+static void IRAM_ATTR _count_dequeued(int tx_class, int64_t queued_us)
+{
+    uint32_t wait_us = (uint32_t)(esp_timer_get_time() - queued_us);
+    econet_stats.tx_queue_depth[tx_class]--;
+    econet_stats.tx_queue_wait_count[tx_class]++;
+    econet_stats.tx_queue_wait_total_us[tx_class] += wait_us;
+    if (wait_us > econet_stats.tx_queue_wait_max_us[tx_class])
     {
-        return 0;
+        econet_stats.tx_queue_wait_max_us[tx_class] = wait_us;
     }
+}
 
-    return stuff_ctx.byte_pos;
+/*** Queue a slot for sending. Call with tx_slot_lock held. */
+static void _sched_enqueue(tx_slot_t *slot)
+{
+    _count_queued(slot->sched.tx_class);
+    econet_tx_sched_enqueue(&tx_sched, &slot->sched);
 }
 
-size_t IRAM_ATTR _generate_flag_stream(uint8_t *bits, size_t bits_size, int number_of_flags)
+/*** Take the next slot to send, immediate operations first */
+static tx_slot_t *IRAM_ATTR _sched_dequeue(void)
 {
-    tx_bitstuff_ctx stuff_ctx = {
-        .bits = bits,
-        .bits_size = bits_size,
-    };
-    for (int i = 0; i < number_of_flags; i++)
+    portENTER_CRITICAL(&tx_slot_lock);
+    tx_slot_t *slot = (tx_slot_t *)econet_tx_sched_dequeue(&tx_sched);
+    if (slot != NULL)
     {
-        _add_byte_unstuffed(&stuff_ctx, 0x7e);
+        _count_dequeued(slot->sched.tx_class, slot->ready_us);
+        slot->state = TX_SLOT_SENDING;
     }
-    if (stuff_ctx.byte_pos > stuff_ctx.bits_size)
+    portEXIT_CRITICAL(&tx_slot_lock);
+    return slot;
+}
+
+/*** Take a slot that's been given up on out of the scheduler. Call with tx_slot_lock held. */
+static void _sched_unlink(tx_slot_t *slot)
+{
+    econet_stats.tx_queue_depth[slot->sched.tx_class]--;
+    econet_tx_sched_unlink(&tx_sched, &slot->sched);
+}
+
+/*** Claim a free TX slot to encode into.
+ *
+ * Returns NULL if none came free in time.
+ */
+static tx_slot_t *_claim_slot(TickType_t timeout)
+{
+    if (xSemaphoreTake(tx_slot_free_sem, timeout) != pdTRUE)
     {
-        return 0;
+        return NULL;
     }
-    return stuff_ctx.byte_pos;
+    tx_slot_t *slot = NULL;
+    portENTER_CRITICAL(&tx_slot_lock);
+    for (int i = 0; i < ECONET_TX_SLOTS; i++)
+    {
+        if (tx_slots[i].state == TX_SLOT_FREE)
+        {
+            slot = &tx_slots[i];
+            slot->state = TX_SLOT_CLAIMED;
+            break;
+        }
+    }
+    portEXIT_CRITICAL(&tx_slot_lock);
+    return slot;
 }
 
-static void IRAM_ATTR _transmit_bits(const uint8_t *bits, size_t length)
+static void _free_slot(tx_slot_t *slot)
 {
-    econet_tx_pre_go();
-    parlio_transmit_config_t transmit_config = {
-        .idle_value = 0x0,
-    };
-    tx_is_in_progress = true;
-    ESP_ERROR_CHECK(parlio_tx_unit_transmit(tx_unit, bits, length * 8, &transmit_config));
-    parlio_tx_unit_wait_all_done(tx_unit, -1);
-    tx_is_in_progress = false;
+    if (slot->imm_reply_buf != NULL)
+    {
+        econet_buf_release(slot->imm_reply_buf);
+        slot->imm_reply_buf = NULL;
+    }
+    xEventGroupClearBits(tx_done_events, TX_SLOT_DONE_BIT(slot));
+    slot->state = TX_SLOT_FREE;
+    xSemaphoreGive(tx_slot_free_sem);
 }
 
-static bool IRAM_ATTR _start_send_and_wait(econet_tx_command_flags_t flags) {
+/*** Hand an encoded slot to the TX task */
+static void _post_slot(tx_slot_t *slot, econet_tx_command_flags_t flags)
+{
+    slot->flags = flags;
+    slot->result = ECONET_SEND_ERROR;
+    slot->imm_reply_len = 0;
+    slot->attempts = 0;
+    slot->notify_task = NULL;
+    slot->ready_us = esp_timer_get_time();
 
-      // Notify sender task
-      econet_tx_command_t cmd = {.cmd = 'S', .flags = flags};
-      if (xQueueSend(tx_command_queue, &cmd, 1000) != pdTRUE)
-      {
-          ESP_LOGE(TAG, "Failed to post econet send command. This is a bug.");
-          return false;
-      }
-  
-      // Wait for send completion
-      if (ulTaskNotifyTake(pdTRUE, 10000) != pdTRUE)
-      {
-          ESP_LOGE(TAG, "Timeout waiting for send. Missing clock or line jammed?");
-          return false;
-      };
-      return true;
+    portENTER_CRITICAL(&tx_slot_lock);
+    slot->state = TX_SLOT_QUEUED;
+    _sched_enqueue(slot);
+    portEXIT_CRITICAL(&tx_slot_lock);
+    xTaskNotify(tx_task, ECONET_TX_NOTIFY_SLOT, eSetBits);
 }
 
-static void IRAM_ATTR _complete_tx_command(econet_acktype_t result)
+static void IRAM_ATTR _complete_tx_command(tx_slot_t *slot, econet_acktype_t result)
 {
-    tx_sent_ack = result;
+    tx_last_done_us = esp_timer_get_time();
     econet_stats.tx_frame_count++;
     switch (result)
     {
@@ -265,138 +588,587 @@ static void IRAM_ATTR _complete_tx_command(econet_acktype_t result)
         econet_stats.rx_nack_count++;
     default:
     }
-    xTaskNotifyGive(tx_sender_task);
+
+    slot->result = result;
+    portENTER_CRITICAL(&tx_slot_lock);
+    slot->state = TX_SLOT_DONE;
+    TaskHandle_t notify_task = slot->notify_task;
+    portEXIT_CRITICAL(&tx_slot_lock);
+    xEventGroupSetBits(tx_done_events, TX_SLOT_DONE_BIT(slot));
+    if (notify_task != NULL)
+    {
+        xTaskNotify(notify_task, slot->notify_bits, eSetBits);
+    }
 }
 
-static void IRAM_ATTR _tx_task(void *params)
+/*** Count the gap between back to back transactions.
+ *
+ * Only transactions already waiting when the previous one finished are
+ * counted, otherwise the gap is down to the sender rather than us.
+ */
+static inline void IRAM_ATTR _record_tx_gap(const tx_slot_t *slot)
 {
-    bool is_data_ready = false;
-    uint8_t ack_bits[128];
+    if (slot->ready_us > tx_last_done_us)
+    {
+        return;
+    }
+    uint32_t gap_us = (uint32_t)(esp_timer_get_time() - tx_last_done_us);
+    econet_stats.tx_gap_hist[log2_bucket(gap_us / ECONET_TX_GAP_HIST_UNIT_US, ECONET_TX_GAP_HIST_BUCKETS)]++;
+}
 
-    tx_task = xTaskGetCurrentTaskHandle();
+/*** Count a transaction phase that started at *start_us and has just ended.
+ *
+ * *start_us is moved on to now, ready to time the next phase.
+ */
+static void IRAM_ATTR _record_tx_phase(int phase, int64_t *start_us)
+{
+    int64_t now_us = esp_timer_get_time();
+    uint32_t phase_us = (uint32_t)(now_us - *start_us);
+    econet_stats.tx_phase_hist[phase][log2_bucket(phase_us / ECONET_TX_PHASE_HIST_UNIT_US, ECONET_TX_PHASE_HIST_BUCKETS)]++;
+    if (phase_us > econet_stats.tx_phase_max_us[phase])
+    {
+        econet_stats.tx_phase_max_us[phase] = phase_us;
+    }
+    *start_us = now_us;
+}
 
-    for (;;)
+/*** Pass a command to the TX task from the RX ISR */
+bool IRAM_ATTR econet_tx_post_from_isr(const econet_tx_command_t *cmd, BaseType_t *is_awoken)
+{
+    econet_tx_command_t queued = *cmd;
+    queued.queued_us = esp_timer_get_time();
+    if (xQueueSendFromISR(tx_command_queue, &queued, is_awoken) != pdTRUE)
     {
-        tx_is_awaiting_imm_reply = false;
+        return false;
+    }
+    if (cmd->cmd == 'A')
+    {
+        _count_queued(ECONET_TX_CLASS_ACK);
+    }
+    xTaskNotifyFromISR(tx_task, ECONET_TX_NOTIFY_CMD, eSetBits, is_awoken);
+    return true;
+}
 
-        _queue_flagstream();
+/*** Get the encoded bitstream for an ACK, generating it if it isn't cached.
+ *
+ * Must only be called with TX idle from the RX ISR, or by the TX task with
+ * tx_is_in_progress set. Returns NULL if the frame couldn't be encoded.
+ */
+static const tx_ack_cache_entry_t *IRAM_ATTR _ack_cache_lookup(const econet_hdr_t *ack_hdr)
+{
+    uint32_t key;
+    memcpy(&key, ack_hdr, sizeof(key));
+    tx_ack_cache_entry_t *entry = &ack_cache[(key * 0x9E3779B1u) >> 28];
 
-        econet_tx_command_t cmd;
-        if (xQueueReceive(tx_command_queue, &cmd, portMAX_DELAY) != pdTRUE)
-        {
-            ESP_LOGE(TAG, "Failed to get TX command queue item");
-            vTaskDelete(NULL);
-            return;
-        }
+    uint32_t generation = ack_cache_generation;
+    if (entry->generation == generation && entry->key == key)
+    {
+        econet_stats.tx_ack_cache_hit_count++;
+        return entry;
+    }
 
-        // Generate ACK.
-        if (cmd.cmd == 'A')
+    econet_stats.tx_ack_cache_miss_count++;
+    entry->generation = 0;
+    entry->bits_len = hdlc_tx_encode_frame(entry->bits, sizeof(entry->bits), (const uint8_t *)ack_hdr, sizeof(econet_hdr_t));
+    if (entry->bits_len == 0)
+    {
+        return NULL;
+    }
+    entry->key = key;
+    entry->generation = generation;
+    return entry;
+}
+
+/*** Forget all cached ACK frames */
+void econet_tx_ack_cache_invalidate(void)
+{
+    ack_cache_generation++;
+}
+
+/*** Send an ACK straight from the RX ISR.
+ *
+ * The ACK is chained onto the armed flag fill, which is then started, so it
+ * goes out without waiting for the TX task. Returns false if the fill isn't
+ * armed or we're already transmitting, in which case the ACK has to go via
+ * the TX task.
+ */
+bool IRAM_ATTR econet_tx_ack_from_isr(const econet_hdr_t *ack_hdr, int64_t frame_end_us, BaseType_t *is_awoken)
+{
+    tx_ack_frame_end_us = frame_end_us;
+
+    if (!ECONET_FAST_ACK || tx_fill != TX_FILL_ARMED || tx_is_in_progress)
+    {
+        return false;
+    }
+
+    const tx_ack_cache_entry_t *ack = _ack_cache_lookup(ack_hdr);
+    if (ack == NULL)
+    {
+        return false;
+    }
+
+    // Set up before chaining, the DMA can move on to the ACK straight away
+    tx_stream = (tx_stream_t){
+        .step = TX_STREAM_END,
+        .idle_left = ECONET_TX_IDLE_CHUNKS,
+        .is_active = true,
+    };
+    tx_ack_is_from_isr = true;
+    if (parlio_tx_unit_loop_append(tx_unit, ack->bits, ack->bits_len * 8) != ESP_OK)
+    {
+        tx_stream.is_active = false;
+        tx_ack_is_from_isr = false;
+        return false;
+    }
+
+    econet_tx_pre_go();
+    tx_fill = TX_FILL_USED;
+    econet_stats.tx_ack_count++;
+    econet_stats.tx_ack_fast_count++;
+    return true;
+}
+
+/*** Wait for the next command, or for the line to go idle.
+ *
+ * Queued commands are returned first. The line going idle is returned as an
+ * 'I' command and, if is_slot_wake is set, a TX slot being posted as an 'S'
+ * command. A slot posted while is_slot_wake is clear is returned by the next
+ * wait that has it set. Returns false on timeout.
+ */
+static bool IRAM_ATTR _wait_tx_command(econet_tx_command_t *cmd, TickType_t timeout, bool is_slot_wake)
+{
+    TimeOut_t timeout_state;
+    vTaskSetTimeOutState(&timeout_state);
+
+    for (;;)
+    {
+        // Re-arm after an ACK from the RX ISR
+        _arm_flag_fill();
+
+        if (xQueueReceive(tx_command_queue, cmd, 0) == pdTRUE)
         {
-            // Generate and send ack
-            size_t tx_len = _generate_frame_bits(ack_bits, sizeof(ack_bits), &cmd.dst_stn, 4);
-            _transmit_bits(ack_bits, tx_len);
-            econet_stats.tx_ack_count++;
-            continue;
+            return true;
         }
 
-        if (cmd.cmd == 'R')
+        if (ulTaskNotifyValueClear(NULL, ECONET_TX_NOTIFY_IDLE) & ECONET_TX_NOTIFY_IDLE)
         {
-            ESP_LOGE(TAG, "Unexpected IMM reply. tx_is_awaiting_imm_reply=%d", tx_is_awaiting_imm_reply);
-            continue;
+            *cmd = (econet_tx_command_t){.cmd = 'I'};
+            return true;
         }
 
-        if (cmd.cmd == 'S')
+        if (is_slot_wake && (ulTaskNotifyValueClear(NULL, ECONET_TX_NOTIFY_SLOT) & ECONET_TX_NOTIFY_SLOT))
         {
-            is_data_ready = true;
+            *cmd = (econet_tx_command_t){.cmd = 'S'};
+            return true;
         }
 
-        if (!is_data_ready || !econet_rx_is_idle())
+        if (xTaskCheckForTimeOut(&timeout_state, &timeout) == pdTRUE ||
+            xTaskNotifyWait(0, ECONET_TX_NOTIFY_CMD | ECONET_TX_NOTIFY_ACK_DONE, NULL, timeout) != pdTRUE)
         {
-            continue;
+            return false;
         }
+    }
+}
+
+/*** Drop a command we aren't going to act on, freeing anything it holds */
+static void _discard_tx_command(econet_tx_command_t *cmd)
+{
+    if (cmd->imm_buf != NULL)
+    {
+        econet_buf_release(cmd->imm_buf);
+        cmd->imm_buf = NULL;
+    }
+}
 
-        is_data_ready = false;
+/*** Drop a command that can't be put back, keeping the ACK queue depth right */
+static void _drop_tx_command(econet_tx_command_t *cmd)
+{
+    if (cmd->cmd == 'A')
+    {
+        portENTER_CRITICAL(&tx_slot_lock);
+        _count_dequeued(ECONET_TX_CLASS_ACK, cmd->queued_us);
+        portEXIT_CRITICAL(&tx_slot_lock);
+    }
+    _discard_tx_command(cmd);
+}
 
-        // Broadcast send (no ACK)
-        if (cmd.flags == ECONET_TX_BROADCAST)
+/*** Did a received ACK or immediate reply come from the station we sent to? */
+static bool _is_reply_from(const econet_tx_command_t *cmd, const econet_hdr_t *reply_hdr)
+{
+    if (cmd->cmd == 'R')
+    {
+        return cmd->imm_length >= sizeof(econet_hdr_t) &&
+               memcmp(cmd->imm_reply + ECONET_RX_BUFFER_WORKSPACE, reply_hdr, sizeof(econet_hdr_t)) == 0;
+    }
+    return cmd->dst_stn == reply_hdr->dst_stn && cmd->dst_net == reply_hdr->dst_net &&
+           cmd->src_stn == reply_hdr->src_stn && cmd->src_net == reply_hdr->src_net;
+}
+
+/*** Wait for the response to a frame we've sent.
+ *
+ * Only a command in expected carrying reply_hdr, or the line going idle as
+ * an 'I' command, is a response. An ACK or reply from any other station is
+ * stray, e.g. late from an earlier transaction, and is dropped. Anything
+ * else arriving in the meantime (e.g. an ACK to send for a frame received)
+ * is held and put back on the front of the queue, in the order it came, for
+ * the TX task to deal with afterwards. Returns false on timeout.
+ */
+#define ECONET_TX_HELD_COMMANDS 4
+static bool _wait_tx_response(econet_tx_command_t *cmd, TickType_t timeout, const char *expected, const econet_hdr_t *reply_hdr)
+{
+    econet_tx_command_t held[ECONET_TX_HELD_COMMANDS];
+    int held_count = 0;
+    bool is_response = false;
+    TimeOut_t timeout_state;
+    vTaskSetTimeOutState(&timeout_state);
+
+    while (_wait_tx_command(cmd, timeout, false))
+    {
+        if (cmd->cmd == 'I' || (strchr(expected, cmd->cmd) != NULL && _is_reply_from(cmd, reply_hdr)))
         {
-            _transmit_bits(tx_bits, tx_bits_len);
-            _complete_tx_command(ECONET_ACK);
-            continue;
+            is_response = true;
+            break;
+        }
+        if (cmd->cmd == 'a' || cmd->cmd == 'R')
+        {
+            ESP_LOGW(TAG, "Ignoring stray '%c' while waiting for %d.%d", cmd->cmd, reply_hdr->src_net, reply_hdr->src_stn);
+            _discard_tx_command(cmd);
+        }
+        else if (held_count < ECONET_TX_HELD_COMMANDS)
+        {
+            held[held_count++] = *cmd;
+        }
+        else
+        {
+            _drop_tx_command(cmd);
         }
+        if (xTaskCheckForTimeOut(&timeout_state, &timeout) == pdTRUE)
+        {
+            break;
+        }
+    }
 
-        // Send scout
-        if (cmd.flags == ECONET_TX_IMM_WITH_REPLY)
+    while (held_count)
+    {
+        held_count--;
+        if (xQueueSendToFront(tx_command_queue, &held[held_count], 0) != pdTRUE)
         {
-            tx_is_awaiting_imm_reply = true;
+            _drop_tx_command(&held[held_count]);
         }
-        _transmit_bits(scout_bits, scout_bits_len);
-        _queue_flagstream();
+    }
+    return is_response;
+}
 
-        // Wait for ack or imm data
-        econet_tx_command_t response_cmd;
-        if (xQueueReceive(tx_command_queue, &response_cmd, 200) == pdFALSE)
+static void _on_backoff_timer(void *arg)
+{
+    tx_retry_is_due = true;
+    xTaskNotify(tx_task, ECONET_TX_NOTIFY_SLOT, eSetBits);
+}
+
+/*** (Re)start the backoff for tx_retry_slot with a fresh random delay */
+static void _start_backoff(void)
+{
+    uint32_t exp = tx_retry_slot->attempts - 1;
+    if (exp > ECONET_TX_BACKOFF_MAX_EXP)
+    {
+        exp = ECONET_TX_BACKOFF_MAX_EXP;
+    }
+    uint32_t window_bits = ECONET_TX_BACKOFF_SLOT_BITS << exp;
+    uint32_t backoff_bits = esp_random() % window_bits;
+
+    tx_retry_is_due = false;
+    esp_timer_stop(tx_backoff_timer);
+    ESP_ERROR_CHECK(esp_timer_start_once(tx_backoff_timer, 1 + (uint64_t)backoff_bits * 1000000 / econet_cfg.clk_freq_hz));
+}
+
+void econet_tx_set_turnaround(uint32_t turnaround_ms)
+{
+    tx_turnaround_us = turnaround_ms * 1000;
+}
+
+/*** How long to wait for a reply of up to reply_len bytes once we've sent.
+ *
+ * The other station's turnaround, then the reply on the line with its
+ * address, CRC and flags, allowing for a stuffed bit in every five.
+ */
+static TickType_t _reply_timeout(uint32_t reply_len)
+{
+    uint32_t clock_hz = econet_rx_bit_clock_hz();
+    uint64_t reply_bits = (uint64_t)(reply_len + 8) * 8 * 6 / 5;
+    uint64_t timeout_us = tx_turnaround_us + reply_bits * 1000000 / clock_hz;
+
+    // Round up, and a tick more as we could be part way through one
+    return (TickType_t)((timeout_us * configTICK_RATE_HZ + 999999) / 1000000) + 1;
+}
+
+/*** Line errors seen by the receiver so far, to spot a scout colliding */
+static inline uint32_t _rx_error_count(void)
+{
+    return econet_stats.rx_crc_fail_count + econet_stats.rx_abort_count + econet_stats.rx_short_frame_count;
+}
+
+/*** Scout wasn't answered. Back off and try again, or give up. */
+static void _scout_failed(tx_slot_t *slot, uint32_t rx_errors)
+{
+    if (_rx_error_count() != rx_errors)
+    {
+        econet_stats.tx_scout_collision_count++;
+    }
+    if (++slot->attempts >= ECONET_TX_SCOUT_ATTEMPTS)
+    {
+        econet_stats.tx_scout_giveup_count++;
+        _complete_tx_command(slot, ECONET_NACK);
+        return;
+    }
+    econet_stats.tx_scout_retry_count++;
+
+    // Not using the submitter's buffer while it backs off, so it can be
+    // released in the meantime
+    portENTER_CRITICAL(&tx_slot_lock);
+    slot->state = TX_SLOT_QUEUED;
+    tx_retry_slot = slot;
+    portEXIT_CRITICAL(&tx_slot_lock);
+    _start_backoff();
+}
+
+/*** Take the slot whose backoff has run out, or NULL if it's been released */
+static tx_slot_t *_take_retry_slot(void)
+{
+    portENTER_CRITICAL(&tx_slot_lock);
+    tx_slot_t *slot = tx_retry_slot;
+    tx_retry_slot = NULL;
+    bool is_abandoned = slot->state == TX_SLOT_ABANDONED;
+    if (!is_abandoned)
+    {
+        slot->state = TX_SLOT_SENDING;
+    }
+    portEXIT_CRITICAL(&tx_slot_lock);
+
+    if (is_abandoned)
+    {
+        _free_slot(slot);
+        return NULL;
+    }
+    return slot;
+}
+
+/*** Run the transaction held in a TX slot through to its result */
+static void IRAM_ATTR _send_slot(tx_slot_t *slot)
+{
+    // A retried scout's wait is its backoff, so only the first counts as queueing
+    int64_t phase_us = slot->ready_us;
+    if (slot->attempts == 0)
+    {
+        _record_tx_gap(slot);
+        _record_tx_phase(ECONET_TX_PHASE_QUEUE, &phase_us);
+    }
+    else
+    {
+        phase_us = esp_timer_get_time();
+    }
+
+    // Broadcast send (no ACK)
+    if (slot->flags == ECONET_TX_BROADCAST)
+    {
+        bool is_sent = _transmit_stream(slot);
+        _record_tx_phase(ECONET_TX_PHASE_DATA, &phase_us);
+        _complete_tx_command(slot, is_sent ? ECONET_ACK : ECONET_NACK);
+        return;
+    }
+
+    // Send scout
+    if (slot->flags == ECONET_TX_IMM_WITH_REPLY)
+    {
+        tx_is_awaiting_imm_reply = true;
+    }
+    uint32_t rx_errors = _rx_error_count();
+    _transmit_bits(slot->scout_bits, slot->scout_bits_len);
+    _record_tx_phase(ECONET_TX_PHASE_SCOUT, &phase_us);
+
+    // Wait for ack or imm data
+    econet_tx_command_t response_cmd;
+    if (!_wait_tx_response(&response_cmd, _reply_timeout(slot->reply_len), "aR", &slot->reply_hdr))
+    {
+        ESP_LOGW(TAG, "Timeout waiting for scout ack");
+        _scout_failed(slot, rx_errors);
+        return;
+    }
+    if (response_cmd.cmd == 'I')
+    {
+        ESP_LOGI(TAG, "Bus became idle whilst waiting for scout ack (%d)", econet_rx_is_idle());
+        _scout_failed(slot, rx_errors);
+        return;
+    }
+    _record_tx_phase(ECONET_TX_PHASE_SCOUT_ACK, &phase_us);
+    if (response_cmd.cmd == 'R')
+    {
+        if (slot->flags == ECONET_TX_IMM_WITH_REPLY)
         {
-            ESP_LOGW(TAG, "Timeout waiting for scout ack");
-            _complete_tx_command(ECONET_NACK);
-            continue;
+            slot->imm_reply = response_cmd.imm_reply + ECONET_RX_BUFFER_WORKSPACE;
+            slot->imm_reply_len = response_cmd.imm_length;
+            slot->imm_reply_buf = response_cmd.imm_buf;
+            _complete_tx_command(slot, ECONET_IMM_REPLY);
+            return;
         }
-        if (response_cmd.cmd == 'I')
+        else
         {
-            ESP_LOGI(TAG, "Bus became idle whilst waiting for scout ack (%d)", econet_rx_is_idle());
-            _complete_tx_command(ECONET_NACK);
-            continue;
+            ESP_LOGE(TAG, "Unexpected IMM reply after scout. tx_is_awaiting_imm_reply=%d", tx_is_awaiting_imm_reply);
+            _discard_tx_command(&response_cmd);
+            _complete_tx_command(slot, ECONET_NACK);
+            return;
+        }
+    }
+    if (slot->flags == ECONET_TX_IMM_NO_DATA)
+    {
+        _complete_tx_command(slot, ECONET_ACK);
+        return;
+    }
+
+    // Send payload frame. One cut short fails its CRC, so won't be taken.
+    if (!_transmit_stream(slot))
+    {
+        ESP_LOGW(TAG, "Underrun sending data frame");
+        _complete_tx_command(slot, ECONET_NACK);
+        return;
+    }
+    _record_tx_phase(ECONET_TX_PHASE_DATA, &phase_us);
+
+    // Wait for ack
+    if (!_wait_tx_response(&response_cmd, _reply_timeout(ECONET_TX_ACK_LEN), "a", &slot->reply_hdr))
+    {
+        ESP_LOGW(TAG, "Timeout waiting for data ack");
+        _complete_tx_command(slot, ECONET_NACK_CORRUPT);
+        return;
+    }
+    if (response_cmd.cmd == 'I')
+    {
+        ESP_LOGW(TAG, "Bus became idle whilst waiting for data ack");
+        _complete_tx_command(slot, ECONET_NACK_CORRUPT);
+        return;
+    }
+    _record_tx_phase(ECONET_TX_PHASE_DATA_ACK, &phase_us);
+    _discard_tx_command(&response_cmd);
+
+    _complete_tx_command(slot, ECONET_ACK);
+}
+
+static void IRAM_ATTR _tx_task(void *params)
+{
+    tx_task = xTaskGetCurrentTaskHandle();
+
+    for (;;)
+    {
+        tx_is_awaiting_imm_reply = false;
+
+        // The RX ISR starts the fill ahead of an ACK it leaves to us. If
+        // that ACK has already been taken as a response, stop the fill
+        // rather than hold the line with flags.
+        if (tx_fill == TX_FILL_RUNNING && uxQueueMessagesWaiting(tx_command_queue) == 0)
+        {
+            _stop_tx_unit();
+            tx_is_in_progress = false;
         }
-        if (response_cmd.cmd == 'R')
+        _arm_flag_fill();
+
+        // Commands (ACKs) go first, then whatever the scheduler picks as
+        // soon as the line is free
+        econet_tx_command_t cmd;
+        if (xQueueReceive(tx_command_queue, &cmd, 0) != pdTRUE)
         {
-            if (cmd.flags == ECONET_TX_IMM_WITH_REPLY)
+            tx_slot_t *slot = NULL;
+            if (!econet_rx_is_idle())
             {
-                _imm_reply = response_cmd.imm_reply + ECONET_RX_BUFFER_WORKSPACE;
-                _imm_reply_len = response_cmd.imm_length;
-                _complete_tx_command(ECONET_IMM_REPLY);
-                continue;
+                // Wait for the line
+            }
+            else if (tx_retry_slot == NULL)
+            {
+                slot = _sched_dequeue();
             }
-            else
+            else if (tx_retry_is_due)
             {
-                ESP_LOGE(TAG, "Unexpected IMM reply after scout. tx_is_awaiting_imm_reply=%d", tx_is_awaiting_imm_reply);
+                slot = _take_retry_slot();
+                if (slot == NULL)
+                {
+                    // Released while backing off. Look for something else.
+                    continue;
+                }
+            }
+            if (slot != NULL)
+            {
+                _send_slot(slot);
                 continue;
             }
+
+            if (!_wait_tx_command(&cmd, portMAX_DELAY, true))
+            {
+                ESP_LOGE(TAG, "Failed to get TX command queue item");
+                vTaskDelete(NULL);
+                return;
+            }
         }
-        if (cmd.flags == ECONET_TX_IMM_NO_DATA)
+
+        // Generate ACK.
+        if (cmd.cmd == 'A')
         {
-            _complete_tx_command(ECONET_ACK);
+            portENTER_CRITICAL(&tx_slot_lock);
+            _count_dequeued(ECONET_TX_CLASS_ACK, cmd.queued_us);
+            portEXIT_CRITICAL(&tx_slot_lock);
+
+            // Keep the RX ISR out of the ACK cache while we use it
+            tx_is_in_progress = true;
+            econet_hdr_t ack_hdr = {
+                .dst_stn = cmd.dst_stn,
+                .dst_net = cmd.dst_net,
+                .src_stn = cmd.src_stn,
+                .src_net = cmd.src_net};
+            const tx_ack_cache_entry_t *ack = _ack_cache_lookup(&ack_hdr);
+            if (ack != NULL)
+            {
+                _transmit_bits(ack->bits, ack->bits_len);
+                _record_ack_turnaround();
+                econet_stats.tx_ack_count++;
+            }
+            else if (tx_fill == TX_FILL_RUNNING)
+            {
+                // Started by the RX ISR, don't leave it holding the line
+                _stop_tx_unit();
+            }
+            tx_is_in_progress = false;
             continue;
         }
 
-        // Send payload frame
-        _transmit_bits(tx_bits, tx_bits_len);
-
-        // Wait for ack
-        if (xQueueReceive(tx_command_queue, &response_cmd, 200) == pdFALSE)
+        if (cmd.cmd == 'R')
         {
-            ESP_LOGW(TAG, "Timeout waiting for data ack");
-            _complete_tx_command(ECONET_NACK_CORRUPT);
+            ESP_LOGE(TAG, "Unexpected IMM reply. tx_is_awaiting_imm_reply=%d", tx_is_awaiting_imm_reply);
+            _discard_tx_command(&cmd);
             continue;
         }
-        if (response_cmd.cmd == 'I')
+
+        // The line was taken while backing off, so start again now it's free
+        if (cmd.cmd == 'I' && tx_retry_slot != NULL)
         {
-            ESP_LOGW(TAG, "Bus became idle whilst waiting for data ack");
-            _complete_tx_command(ECONET_NACK_CORRUPT);
-            continue;
+            econet_stats.tx_scout_defer_count++;
+            _start_backoff();
         }
 
-        _complete_tx_command(ECONET_ACK);
+        // Slot posted ('S') or line idle ('I'). Go round and look again.
     }
 }
 
-econet_acktype_t econet_send(uint8_t *data, uint16_t length, uint8_t **imm_reply, uint16_t *imm_reply_len)
+econet_tx_request_t *econet_tx_submit(uint8_t *data, uint16_t length, uint8_t source, TickType_t timeout)
 {
-    tx_sender_task = xTaskGetCurrentTaskHandle();
+    int64_t phase_us = esp_timer_get_time();
+
+    if (source >= ECONET_TX_SOURCES)
+    {
+        ESP_LOGE(TAG, "Bad TX source %d", source);
+        return NULL;
+    }
 
     if (length < sizeof(econet_scout_t))
     {
         ESP_LOGE(TAG, "Refusing to send short packet len=%d", length);
-        return ECONET_SEND_ERROR;
+        return NULL;
     }
 
     // Extract scout
@@ -405,17 +1177,14 @@ econet_acktype_t econet_send(uint8_t *data, uint16_t length, uint8_t **imm_reply
     memcpy(&scout, data, sizeof(scout));
 
     // Broadcast
-    if (scout.hdr.dst_stn==255 || scout.hdr.dst_net==255) 
+    bool is_broadcast = scout.hdr.dst_stn == 255 || scout.hdr.dst_net == 255;
+    if (is_broadcast)
     {
-        tx_bits_len = _generate_frame_bits(tx_bits, sizeof(tx_bits), data, length);
-        if (!_start_send_and_wait(ECONET_TX_BROADCAST)) {
-            return ECONET_SEND_ERROR;
-        }
-        return tx_sent_ack;
+        tx_cmd_flags = ECONET_TX_BROADCAST;
     }
 
     // Immedate frame handling
-    if (scout.port == 0) 
+    else if (scout.port == 0)
     {
         if (scout.control == ECONET_CTRL_PEEK || scout.control == ECONET_CTRL_MACHINETYPE || scout.control == ECONET_CTRL_GETREGISTERS)
         {
@@ -427,43 +1196,159 @@ econet_acktype_t econet_send(uint8_t *data, uint16_t length, uint8_t **imm_reply
         }
     }
 
-    if (tx_cmd_flags == ECONET_TX_IMM_WITH_REPLY || tx_cmd_flags == ECONET_TX_IMM_NO_DATA)
+    bool is_imm = tx_cmd_flags == ECONET_TX_IMM_WITH_REPLY || tx_cmd_flags == ECONET_TX_IMM_NO_DATA;
+    if (is_imm && length - sizeof(econet_scout_t) > 8)
+    {
+        ESP_LOGE(TAG, "Refusing to send immediate frame with too much data. length=%d", length);
+        return NULL;
+    }
+
+    tx_slot_t *slot = _claim_slot(timeout);
+    if (slot == NULL)
     {
-        // Generate IMM scout frame with attached data
-        if (length - sizeof(econet_scout_t) > 8)
+        ESP_LOGW(TAG, "No free TX slot");
+        return NULL;
+    }
+
+    if (is_broadcast)
+    {
+        slot->chunk0_len = _stream_prepare(&slot->stream, slot->chunk0, data, length);
+    }
+    else
+    {
+        if (is_imm)
+        {
+            // Generate IMM scout frame with attached data
+            slot->scout_bits_len = hdlc_tx_encode_frame(slot->scout_bits, sizeof(slot->scout_bits), data, length);
+        }
+        else
         {
-            ESP_LOGE(TAG, "Refusing to send immediate frame with too much data. length=%d", length);
-            return ECONET_SEND_ERROR;
+            // Generate normal scout frame
+            slot->scout_bits_len = hdlc_tx_encode_frame(slot->scout_bits, sizeof(slot->scout_bits), (uint8_t *)&scout, sizeof(scout));
         }
-        scout_bits_len = _generate_frame_bits(scout_bits, sizeof(scout_bits), data, length);
+
+        // Generate payload frame
+        data[2] = scout.hdr.dst_stn;
+        data[3] = scout.hdr.dst_net;
+        data[4] = scout.hdr.src_stn;
+        data[5] = scout.hdr.src_net;
+        slot->chunk0_len = _stream_prepare(&slot->stream, slot->chunk0, &data[2], length - 2);
     }
-    else
+
+    // Answers come back from the station we address, to us
+    slot->reply_hdr.dst_stn = scout.hdr.src_stn;
+    slot->reply_hdr.dst_net = scout.hdr.src_net;
+    slot->reply_hdr.src_stn = scout.hdr.dst_stn;
+    slot->reply_hdr.src_net = scout.hdr.dst_net;
+
+    // PEEK replies with the memory from the start address up to the end
+    slot->reply_len = ECONET_TX_ACK_LEN;
+    if (tx_cmd_flags == ECONET_TX_IMM_WITH_REPLY)
     {
-        // Generate normal scout frame
-        scout_bits_len = _generate_frame_bits(scout_bits, sizeof(scout_bits), (uint8_t *)&scout, sizeof(scout));
+        slot->reply_len = ECONET_TX_IMM_REPLY_LEN;
+        if (scout.control == ECONET_CTRL_PEEK && length >= sizeof(econet_scout_t) + 8)
+        {
+            const uint8_t *range = data + sizeof(econet_scout_t);
+            uint32_t start = range[0] | range[1] << 8 | range[2] << 16 | (uint32_t)range[3] << 24;
+            uint32_t end = range[4] | range[5] << 8 | range[6] << 16 | (uint32_t)range[7] << 24;
+            uint32_t peek_len = end - start;
+            slot->reply_len = sizeof(econet_hdr_t) + (peek_len < ECONET_MTU ? peek_len : ECONET_MTU);
+        }
     }
 
-    // Generate payload frame
-    data[2] = scout.hdr.dst_stn;
-    data[3] = scout.hdr.dst_net;
-    data[4] = scout.hdr.src_stn;
-    data[5] = scout.hdr.src_net;
-    tx_bits_len = _generate_frame_bits(tx_bits, sizeof(tx_bits), &data[2], length - 2);
+    // Hand over to the TX task
+    slot->sched.tx_class = is_imm ? ECONET_TX_CLASS_IMM : ECONET_TX_CLASS_DATA;
+    slot->sched.source = source;
+    slot->sched.cost = length;
+    _record_tx_phase(ECONET_TX_PHASE_ENCODE, &phase_us);
+    _post_slot(slot, tx_cmd_flags);
+    return slot;
+}
+
+bool econet_tx_is_done(const econet_tx_request_t *req)
+{
+    return req == NULL || req->state == TX_SLOT_DONE;
+}
+
+/*** Set notify_bits in a task's notification value once a request is done.
+ *
+ * Straight away if it's already done, or failed to submit (req is NULL).
+ * Lets a task keep several requests going and collect each result as it
+ * comes in, rather than blocking in econet_tx_wait() on one at a time.
+ */
+void econet_tx_notify_when_done(econet_tx_request_t *req, TaskHandle_t task, uint32_t notify_bits)
+{
+    bool is_done = true;
+    if (req != NULL)
+    {
+        portENTER_CRITICAL(&tx_slot_lock);
+        is_done = req->state == TX_SLOT_DONE;
+        req->notify_task = task;
+        req->notify_bits = notify_bits;
+        portEXIT_CRITICAL(&tx_slot_lock);
+    }
+    if (is_done)
+    {
+        xTaskNotify(task, notify_bits, eSetBits);
+    }
+}
 
-    // Notify sender task
-    if (!_start_send_and_wait(tx_cmd_flags)) {
+econet_acktype_t econet_tx_wait(econet_tx_request_t *req, TickType_t timeout, uint8_t **imm_reply, uint16_t *imm_reply_len)
+{
+    if (req == NULL)
+    {
         return ECONET_SEND_ERROR;
     }
-  
+
+    EventBits_t bit = TX_SLOT_DONE_BIT(req);
+    if (!(xEventGroupWaitBits(tx_done_events, bit, pdFALSE, pdTRUE, timeout) & bit))
+    {
+        ESP_LOGE(TAG, "Timeout waiting for send. Missing clock or line jammed?");
+        return ECONET_SEND_ERROR;
+    }
+
     if (imm_reply)
     {
-        if (_imm_reply_len >= 4)
+        if (req->imm_reply_len >= 4)
         {
-            *imm_reply = _imm_reply + 4;
-            *imm_reply_len = _imm_reply_len - 4;
+            *imm_reply = req->imm_reply + 4;
+            *imm_reply_len = req->imm_reply_len - 4;
         }
     }
-    return tx_sent_ack;
+    return req->result;
+}
+
+void econet_tx_release(econet_tx_request_t *req)
+{
+    if (req == NULL)
+    {
+        return;
+    }
+
+    // A request still waiting is dropped without being sent. One backing off
+    // is left for the TX task to drop, as it holds on to it until the
+    // backoff runs out.
+    portENTER_CRITICAL(&tx_slot_lock);
+    tx_slot_state_t state = req->state;
+    if (state == TX_SLOT_QUEUED && req == tx_retry_slot)
+    {
+        req->state = TX_SLOT_ABANDONED;
+        portEXIT_CRITICAL(&tx_slot_lock);
+        return;
+    }
+    if (state == TX_SLOT_QUEUED)
+    {
+        _sched_unlink(req);
+    }
+    portEXIT_CRITICAL(&tx_slot_lock);
+
+    // One on the line is still reading the submitter's buffer, so see it
+    // through. It's bounded by the ACK waits and scout retries.
+    if (state == TX_SLOT_SENDING)
+    {
+        xEventGroupWaitBits(tx_done_events, TX_SLOT_DONE_BIT(req), pdFALSE, pdTRUE, portMAX_DELAY);
+    }
+    _free_slot(req);
 }
 
 void econet_tx_setup(void)
@@ -487,19 +1372,34 @@ void econet_tx_setup(void)
         },
         .output_clk_freq_hz = econet_cfg.clk_freq_hz,
         .trans_queue_depth = 4,
-        .max_transfer_size = sizeof(tx_bits),
+        .max_transfer_size = ECONET_TX_CHUNK_SIZE,
         .sample_edge = PARLIO_SAMPLE_EDGE_POS, // This is no-op - we're not using the output clock. See econet_tx_start.
         .bit_pack_order = PARLIO_BIT_PACK_ORDER_MSB,
     };
     ESP_ERROR_CHECK(parlio_new_tx_unit(&tx_config, &tx_unit));
 
+    parlio_tx_event_callbacks_t cbs = {
+        .on_buffer_switched = _on_tx_buffer_switched,
+    };
+    ESP_ERROR_CHECK(parlio_tx_unit_register_event_callbacks(tx_unit, &cbs, NULL));
+
     tx_command_queue = xQueueCreate(8, sizeof(econet_tx_command_t));
+    tx_slot_free_sem = xSemaphoreCreateCounting(ECONET_TX_SLOTS, ECONET_TX_SLOTS);
+    tx_done_events = xEventGroupCreate();
+
+    esp_timer_create_args_t backoff_timer_args = {
+        .callback = _on_backoff_timer,
+        .name = "econet_backoff",
+    };
+    ESP_ERROR_CHECK(esp_timer_create(&backoff_timer_args, &tx_backoff_timer));
 
-    // Pre-calculate flag bitstream
-    tx_flag_stream_length = _generate_flag_stream(tx_flag_stream, sizeof(tx_flag_stream), ECONET_FLAGSTREAM_PADDING);
-    if (tx_flag_stream_length == 0)
+    // Pre-calculate bit stuffing and flag bitstream
+    hdlc_tx_build_table();
+    tx_flag_fill_length = _generate_flag_stream(tx_flag_fill, sizeof(tx_flag_fill), ECONET_TX_FILL_FLAGS);
+    if (tx_flag_fill_length != sizeof(tx_flag_fill))
     {
-        ESP_LOGE(TAG, "Insufficient buffer for flag stream!");
+        // Padding would put idle between the flags each time round the loop
+        ESP_LOGE(TAG, "Flag fill must be a whole number of words!");
         vTaskDelete(NULL);
         return;
     }
@@ -0,0 +1,154 @@
+/*
+ * EconetWiFi
+ * Copyright (c) 2025 Paul G. Banks <https://paulbanks.org/projects/econet>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * See the LICENSE file in the project root for full license information.
+ */
+
+#include <stddef.h>
+#include "econet_tx_sched.h"
+
+/*** Queue an entry to be sent */
+void econet_tx_sched_enqueue(econet_tx_sched_t *sched, econet_tx_sched_entry_t *entry)
+{
+    entry->next = NULL;
+
+    if (entry->tx_class == ECONET_TX_CLASS_IMM)
+    {
+        if (sched->imm_tail != NULL)
+        {
+            sched->imm_tail->next = entry;
+        }
+        else
+        {
+            sched->imm_head = entry;
+        }
+        sched->imm_tail = entry;
+        return;
+    }
+
+    econet_tx_flow_t *flow = &sched->flows[entry->source];
+    if (flow->tail != NULL)
+    {
+        flow->tail->next = entry;
+        flow->tail = entry;
+        return;
+    }
+
+    // Source becomes active and joins the back of the round
+    flow->head = flow->tail = entry;
+    flow->deficit = 0;
+    sched->drr_active[(sched->drr_first + sched->drr_count) % ECONET_TX_SOURCES] = entry->source;
+    sched->drr_count++;
+}
+
+/*** Pick the data frame to send next by deficit round robin */
+static econet_tx_sched_entry_t *IRAM_ATTR _drr_dequeue(econet_tx_sched_t *sched)
+{
+    while (sched->drr_count)
+    {
+        econet_tx_flow_t *flow = &sched->flows[sched->drr_active[sched->drr_first]];
+        if (!sched->drr_is_turn_started)
+        {
+            flow->deficit += ECONET_TX_DRR_QUANTUM;
+            sched->drr_is_turn_started = true;
+        }
+
+        econet_tx_sched_entry_t *entry = flow->head;
+        if (entry->cost <= flow->deficit)
+        {
+            flow->deficit -= entry->cost;
+            flow->head = entry->next;
+            if (flow->head == NULL)
+            {
+                // Nothing left, so no credit carried over
+                flow->tail = NULL;
+                flow->deficit = 0;
+                sched->drr_first = (sched->drr_first + 1) % ECONET_TX_SOURCES;
+                sched->drr_count--;
+                sched->drr_is_turn_started = false;
+            }
+            return entry;
+        }
+
+        // Out of credit. Go to the back of the round.
+        sched->drr_active[(sched->drr_first + sched->drr_count) % ECONET_TX_SOURCES] = sched->drr_active[sched->drr_first];
+        sched->drr_first = (sched->drr_first + 1) % ECONET_TX_SOURCES;
+        sched->drr_is_turn_started = false;
+    }
+    return NULL;
+}
+
+/*** Take the next entry to send, immediate operations first. NULL if there's nothing. */
+econet_tx_sched_entry_t *IRAM_ATTR econet_tx_sched_dequeue(econet_tx_sched_t *sched)
+{
+    econet_tx_sched_entry_t *entry = sched->imm_head;
+    if (entry == NULL)
+    {
+        return _drr_dequeue(sched);
+    }
+
+    sched->imm_head = entry->next;
+    if (sched->imm_head == NULL)
+    {
+        sched->imm_tail = NULL;
+    }
+    return entry;
+}
+
+/*** Take a queued entry that's been given up on out of the scheduler */
+void econet_tx_sched_unlink(econet_tx_sched_t *sched, econet_tx_sched_entry_t *entry)
+{
+    econet_tx_sched_entry_t **head = &sched->imm_head;
+    econet_tx_sched_entry_t **tail = &sched->imm_tail;
+    econet_tx_flow_t *flow = NULL;
+    if (entry->tx_class != ECONET_TX_CLASS_IMM)
+    {
+        flow = &sched->flows[entry->source];
+        head = &flow->head;
+        tail = &flow->tail;
+    }
+
+    econet_tx_sched_entry_t *prev = NULL;
+    for (econet_tx_sched_entry_t **link = head; *link != NULL; prev = *link, link = &(*link)->next)
+    {
+        if (*link == entry)
+        {
+            *link = entry->next;
+            if (*tail == entry)
+            {
+                *tail = prev;
+            }
+            break;
+        }
+    }
+    if (flow == NULL || flow->head != NULL)
+    {
+        return;
+    }
+
+    // Source has nothing left, so it drops out of the round
+    flow->deficit = 0;
+    for (int i = 0; i < sched->drr_count; i++)
+    {
+        if (sched->drr_active[(sched->drr_first + i) % ECONET_TX_SOURCES] != entry->source)
+        {
+            continue;
+        }
+        if (i == 0)
+        {
+            sched->drr_is_turn_started = false;
+        }
+        for (; i < sched->drr_count - 1; i++)
+        {
+            sched->drr_active[(sched->drr_first + i) % ECONET_TX_SOURCES] = sched->drr_active[(sched->drr_first + i + 1) % ECONET_TX_SOURCES];
+        }
+        sched->drr_count--;
+        break;
+    }
+}
@@ -0,0 +1,66 @@
+/*
+ * EconetWiFi
+ * Copyright (c) 2025 Paul G. Banks <https://paulbanks.org/projects/econet>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * See the LICENSE file in the project root for full license information.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_attr.h"
+
+// Egress scheduler classes, highest priority first
+#define ECONET_TX_CLASS_ACK 0  ///< ACKs for frames we've received
+#define ECONET_TX_CLASS_IMM 1  ///< Immediate operations
+#define ECONET_TX_CLASS_DATA 2 ///< Data and broadcast frames
+#define ECONET_TX_CLASSES 3
+
+// Data frames are shared out fairly between this many sources
+#define ECONET_TX_SOURCES 32
+
+// Egress scheduler. ACKs come first (they're commands on the TX task's
+// queue and never get here), then immediate operations in the order they
+// were queued. Data frames are shared out between sources by deficit round
+// robin: each source with frames waiting gets ECONET_TX_DRR_QUANTUM bytes of
+// credit per turn and sends frames until the next doesn't fit, so a source
+// sending big frames back to back can't hold up the others.
+//
+// No locking here, the caller guards the scheduler.
+#define ECONET_TX_DRR_QUANTUM 1024
+
+typedef struct econet_tx_sched_entry
+{
+    struct econet_tx_sched_entry *next;
+    uint8_t tx_class; ///< ECONET_TX_CLASS_IMM or ECONET_TX_CLASS_DATA
+    uint8_t source;   ///< Submitter's source id, for sharing the line
+    uint16_t cost;    ///< Bytes charged to the source's deficit
+} econet_tx_sched_entry_t;
+
+typedef struct
+{
+    econet_tx_sched_entry_t *head;
+    econet_tx_sched_entry_t *tail;
+    uint32_t deficit;
+} econet_tx_flow_t;
+
+typedef struct
+{
+    econet_tx_sched_entry_t *imm_head;
+    econet_tx_sched_entry_t *imm_tail;
+    econet_tx_flow_t flows[ECONET_TX_SOURCES];
+    uint8_t drr_active[ECONET_TX_SOURCES]; ///< Sources with frames waiting, in turn order
+    uint8_t drr_first;
+    uint8_t drr_count;
+    bool drr_is_turn_started; ///< First active source has had its quantum
+} econet_tx_sched_t;
+
+void econet_tx_sched_enqueue(econet_tx_sched_t *sched, econet_tx_sched_entry_t *entry);
+econet_tx_sched_entry_t *econet_tx_sched_dequeue(econet_tx_sched_t *sched);
+void econet_tx_sched_unlink(econet_tx_sched_t *sched, econet_tx_sched_entry_t *entry);
@@ -0,0 +1,346 @@
+/*
+ * EconetWiFi
+ * Copyright (c) 2025 Paul G. Banks <https://paulbanks.org/projects/econet>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * See the LICENSE file in the project root for full license information.
+ */
+
+#include "hdlc.h"
+#include "crc16.h"
+
+// Kept in DRAM as the RX deframer and TX streamer use these from ISRs
+hdlc_step_t DRAM_ATTR hdlc_rx_table[HDLC_RUN_STATES][256];
+hdlc_tx_step_t DRAM_ATTR hdlc_tx_table[HDLC_TX_RUN_STATES][256];
+uint32_t DRAM_ATTR hdlc_tx_flag_symbols;
+
+void hdlc_rx_build_table(void)
+{
+    for (int run = 0; run < HDLC_RUN_STATES; run++)
+    {
+        for (int c = 0; c < 256; c++)
+        {
+            hdlc_step_t step = {};
+            uint32_t data = 0;
+            uint32_t data_count = 0;
+            uint32_t seg_len = 0;
+            uint32_t events = 0;
+            uint32_t r = run;
+
+            // Bits arrive MSB first. A run of exactly 6 ones followed by a 0
+            // is a flag (0x7E), followed by a 1 it's an abort (0x7F). Any
+            // other 0 following 5 or more ones was stuffed by the sender.
+            for (int i = 7; i >= 0; i--)
+            {
+                uint32_t bit = (c >> i) & 1;
+                uint32_t ev = HDLC_EV_NONE;
+                if (bit)
+                {
+                    if (r == 6)
+                    {
+                        ev = HDLC_EV_ABORT;
+                    }
+                    else
+                    {
+                        data |= 1u << data_count++;
+                        seg_len++;
+                    }
+                    r = r < HDLC_RUN_STATES - 1 ? r + 1 : r;
+                }
+                else
+                {
+                    if (r == 6)
+                    {
+                        ev = HDLC_EV_FLAG;
+                    }
+                    else if (r < 5)
+                    {
+                        data_count++;
+                        seg_len++;
+                    }
+                    r = 0;
+                }
+
+                if (ev != HDLC_EV_NONE)
+                {
+                    if (events == 0)
+                    {
+                        step.len0 = seg_len;
+                        step.ev0 = ev;
+                    }
+                    else
+                    {
+                        step.len1 = seg_len;
+                        step.ev1 = ev;
+                    }
+                    events++;
+                    seg_len = 0;
+                }
+            }
+
+            if (events == 0)
+            {
+                step.len0 = seg_len;
+            }
+            else if (events == 1)
+            {
+                step.len1 = seg_len;
+            }
+            else
+            {
+                step.len2 = seg_len;
+            }
+
+            uint32_t lead_ones = 0;
+            while (lead_ones < 8 && (c & (0x80 >> lead_ones)))
+            {
+                lead_ones++;
+            }
+
+            step.data = data;
+            step.next_run = r;
+            step.lead_ones = lead_ones;
+            hdlc_rx_table[run][c] = step;
+        }
+    }
+}
+
+/*** Skip the rest of the frame, bits already had still counting towards its size */
+static inline void IRAM_ATTR _skip_frame(hdlc_rx_t *rx, uint32_t bits_had)
+{
+    rx->frame_state = HDLC_FRAME_SKIP;
+    rx->skip_bits = bits_had;
+}
+
+static inline void IRAM_ATTR _add_bits(hdlc_rx_t *rx, const hdlc_rx_ops_t *ops, uint32_t bits, uint32_t count)
+{
+    if (rx->frame_state == HDLC_FRAME_SKIP)
+    {
+        rx->skip_bits += count;
+        return;
+    }
+    if (rx->frame_state != HDLC_FRAME_ACTIVE || count == 0)
+    {
+        return;
+    }
+
+    // Data is LSB first
+    rx->data_shift |= (bits & ((1u << count) - 1)) << rx->data_bits;
+    rx->data_bits += count;
+    if (rx->data_bits < 8)
+    {
+        return;
+    }
+    uint8_t c = rx->data_shift & 0xFF;
+    rx->data_shift >>= 8;
+    rx->data_bits -= 8;
+
+    if (!ops->add_byte(rx, c))
+    {
+        _skip_frame(rx, 8 + rx->data_bits);
+        return;
+    }
+    rx->frame_len++;
+
+    // Once we have the destination we can tell if we need the rest
+    if (rx->frame_len == 2 && !ops->is_wanted(rx))
+    {
+        _skip_frame(rx, rx->data_bits);
+        return;
+    }
+
+    if (rx->frame_len == ops->max_len)
+    {
+        rx->frame_state = HDLC_FRAME_NONE;
+        ops->oversize(rx);
+    }
+}
+
+static inline void IRAM_ATTR _rx_event(hdlc_rx_t *rx, const hdlc_rx_ops_t *ops, uint32_t ev)
+{
+    if (ev == HDLC_EV_FLAG)
+    {
+        if (rx->frame_state == HDLC_FRAME_SKIP)
+        {
+            rx->frame_state = HDLC_FRAME_NONE;
+            ops->skipped(rx, rx->frame_len + rx->skip_bits / 8);
+        }
+        else if (rx->frame_state == HDLC_FRAME_ACTIVE && rx->frame_len > 1)
+        {
+            rx->frame_state = HDLC_FRAME_NONE;
+            ops->end(rx);
+        }
+        else
+        {
+            // An opening flag, or more flags before anything else so we're
+            // still at the start of the frame
+            rx->data_shift = 0;
+            rx->data_bits = 0;
+            rx->frame_len = 0;
+            rx->skip_bits = 0;
+            rx->frame_state = HDLC_FRAME_ACTIVE;
+            ops->begin(rx);
+        }
+    }
+    else if (ev == HDLC_EV_ABORT && rx->frame_state != HDLC_FRAME_NONE)
+    {
+        rx->frame_state = HDLC_FRAME_NONE;
+
+        // Don't count glitches as aborts
+        if (rx->frame_len > 1)
+        {
+            ops->aborted(rx);
+        }
+    }
+}
+
+/*** Clock in a byte off the line, MSB first.
+ *
+ * While is_line_held (we're sending) the line can't be idle, so the run of
+ * 1s towards idle starts again.
+ */
+void IRAM_ATTR hdlc_rx_clk_byte(hdlc_rx_t *rx, const hdlc_rx_ops_t *ops, uint8_t c, bool is_line_held)
+{
+    const hdlc_step_t step = hdlc_rx_table[rx->run][c];
+    rx->run = step.next_run;
+
+    if (!is_line_held)
+    {
+        uint32_t idle_ones = rx->idle_ones;
+        uint32_t ones = idle_ones + step.lead_ones;
+        if (idle_ones < ops->idle_bits && ones >= ops->idle_bits)
+        {
+            ops->idle(rx);
+        }
+
+        // A zero anywhere in the byte restarts the count from its trailing 1s
+        if (step.lead_ones == 8)
+        {
+            rx->idle_ones = ones < ops->idle_bits ? ones : ops->idle_bits;
+        }
+        else
+        {
+            rx->idle_ones = step.next_run;
+        }
+    }
+    else
+    {
+        rx->idle_ones = 0;
+    }
+
+    // Fast path: nothing but data bits and we're not keeping a frame
+    if (step.ev0 == HDLC_EV_NONE && rx->frame_state != HDLC_FRAME_ACTIVE)
+    {
+        rx->skip_bits += step.len0;
+        return;
+    }
+
+    uint32_t bits = step.data;
+    _add_bits(rx, ops, bits, step.len0);
+    if (step.ev0 == HDLC_EV_NONE)
+    {
+        return;
+    }
+    _rx_event(rx, ops, step.ev0);
+
+    bits >>= step.len0;
+    _add_bits(rx, ops, bits, step.len1);
+    if (step.ev1 == HDLC_EV_NONE)
+    {
+        return;
+    }
+    _rx_event(rx, ops, step.ev1);
+
+    bits >>= step.len1;
+    _add_bits(rx, ops, bits, step.len2);
+}
+
+void hdlc_tx_build_table(void)
+{
+    for (int run = 0; run < HDLC_TX_RUN_STATES; run++)
+    {
+        for (int c = 0; c < 256; c++)
+        {
+            uint32_t symbols = 0;
+            uint32_t len = 0;
+            uint32_t r = run;
+
+            // Data is LSB first. Each bit drives the line with the driver
+            // enabled, and a 0 is stuffed after five 1s.
+            for (int j = 0; j < 8; j++)
+            {
+                uint32_t bit = (c >> j) & 1;
+                symbols = symbols << HDLC_TX_SYMBOL_BITS | bit | 2;
+                len++;
+                r = bit ? r + 1 : 0;
+                if (r == 5)
+                {
+                    symbols = symbols << HDLC_TX_SYMBOL_BITS | 2;
+                    len++;
+                    r = 0;
+                }
+            }
+
+            hdlc_tx_table[run][c] = (hdlc_tx_step_t){
+                .symbols = symbols,
+                .len = len,
+                .next_run = r,
+            };
+        }
+    }
+
+    // Flags aren't stuffed
+    hdlc_tx_flag_symbols = 0;
+    for (int j = 0; j < 8; j++)
+    {
+        hdlc_tx_flag_symbols = hdlc_tx_flag_symbols << HDLC_TX_SYMBOL_BITS | ((0x7e >> j) & 1) | 2;
+    }
+}
+
+/*** Encode a frame into PARLIO symbols. bits must be word aligned.
+ *
+ * Returns the number of bytes used, or 0 if bits_size wasn't enough.
+ */
+size_t IRAM_ATTR hdlc_tx_encode_frame(uint8_t *bits, size_t bits_size, const uint8_t *payload, size_t payload_length)
+{
+
+    hdlc_tx_ctx_t stuff_ctx = {
+        .bits = bits,
+        .bits_size = bits_size,
+    };
+
+    // No opening flag, the frame is chained straight onto the flag fill
+    for (int i = 0; i < payload_length; i++)
+    {
+        hdlc_tx_add_byte(&stuff_ctx, payload[i]);
+    }
+
+    // Compute CRC over unstuffed payload bytes
+    uint16_t fcs = crc16_x25(payload, payload_length);
+
+    // Emit CRC (16 bits)
+    uint8_t fcs_bytes[2] = {(uint8_t)(fcs & 0xFF), (uint8_t)(fcs >> 8)};
+    for (int i = 0; i < 2; i++)
+    {
+        hdlc_tx_add_byte(&stuff_ctx, fcs_bytes[i]);
+    }
+
+    // Flag must be unstuffed (but still packed)
+    hdlc_tx_add_flag(&stuff_ctx);
+
+    // Pad out block so it's on correct boundary
+    // otherwise subequent transactions are screwed up
+    hdlc_tx_pad_to_word(&stuff_ctx);
+
+    // Check for overflow
+    if (stuff_ctx.byte_pos > stuff_ctx.bits_size)
+    {
+        return 0;
+    }
+
+    return stuff_ctx.byte_pos;
+}
@@ -0,0 +1,154 @@
+/*
+ * EconetWiFi
+ * Copyright (c) 2025 Paul G. Banks <https://paulbanks.org/projects/econet>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * See the LICENSE file in the project root for full license information.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "esp_attr.h"
+#include "utils.h"
+
+// HDLC deframer step, precomputed for every (run of 1s, input byte) pair.
+//
+// Flag, abort and bit-stuffing detection only depend on how many 1 bits
+// immediately precede the current bit, so that run length (saturated at 7)
+// is all the state the deframer needs to carry between bytes. Each entry
+// describes what the byte contains: up to three groups of destuffed data
+// bits separated by up to two flag/abort events.
+#define HDLC_EV_NONE 0
+#define HDLC_EV_FLAG 1
+#define HDLC_EV_ABORT 2
+#define HDLC_RUN_STATES 8
+
+typedef struct
+{
+    uint32_t data : 8;      ///< Destuffed data bits, first received in bit 0
+    uint32_t len0 : 4;      ///< Data bits before ev0
+    uint32_t ev0 : 2;       ///< First event in the byte
+    uint32_t len1 : 4;      ///< Data bits between ev0 and ev1
+    uint32_t ev1 : 2;       ///< Second event in the byte
+    uint32_t len2 : 4;      ///< Data bits after ev1
+    uint32_t next_run : 3;  ///< Trailing run of 1s carried into the next byte
+    uint32_t lead_ones : 4; ///< Leading run of 1s (8 if the byte is 0xFF)
+} hdlc_step_t;
+
+// Indexed by the run of 1s so far and the next byte off the line, MSB first
+extern hdlc_step_t hdlc_rx_table[HDLC_RUN_STATES][256];
+
+void hdlc_rx_build_table(void);
+
+// Bit stuffing step for the TX encoder, precomputed for every (run of 1s,
+// input byte) pair. The run is never more than 4 between bytes, as a fifth
+// 1 is always followed by a stuffed 0. A byte stuffs to at most 10 line
+// bits, each sent as a HDLC_TX_SYMBOL_BITS wide PARLIO symbol of the data
+// bit with the driver enable bit above it.
+#define HDLC_TX_SYMBOL_BITS 2
+#define HDLC_TX_RUN_STATES 5
+
+typedef struct
+{
+    uint32_t symbols : 20; ///< PARLIO symbols, first to send in the top bits
+    uint32_t len : 4;      ///< Line bits after stuffing (8 to 10)
+    uint32_t next_run : 3; ///< Trailing run of 1s carried into the next byte
+} hdlc_tx_step_t;
+
+extern hdlc_tx_step_t hdlc_tx_table[HDLC_TX_RUN_STATES][256];
+extern uint32_t hdlc_tx_flag_symbols; ///< Flag as symbols, never stuffed
+
+typedef struct
+{
+    uint8_t *bits;
+    size_t bits_size;
+    uint32_t byte_pos;
+    uint64_t acc;     ///< Symbols not yet written, most recent in the low bits
+    uint32_t acc_len; ///< Number of bits held in acc
+    uint8_t one_count;
+} hdlc_tx_ctx_t;
+
+void hdlc_tx_build_table(void);
+size_t hdlc_tx_encode_frame(uint8_t *bits, size_t bits_size, const uint8_t *payload, size_t payload_length);
+
+/*** Append symbols, writing out each 32 bit word as it fills */
+static inline void IRAM_ATTR hdlc_tx_add_symbols(hdlc_tx_ctx_t *ctx, uint32_t symbols, uint32_t len)
+{
+    ctx->acc = ctx->acc << len | symbols;
+    ctx->acc_len += len;
+    if (ctx->acc_len >= 32)
+    {
+        ctx->acc_len -= 32;
+        if (ctx->byte_pos + 4 <= ctx->bits_size)
+        {
+            // First symbol goes out of the MSB of the first byte
+            *(uint32_t *)&ctx->bits[ctx->byte_pos] = __builtin_bswap32((uint32_t)(ctx->acc >> ctx->acc_len));
+        }
+        ctx->byte_pos += 4;
+    }
+}
+
+static inline void IRAM_ATTR hdlc_tx_add_flag(hdlc_tx_ctx_t *ctx)
+{
+    hdlc_tx_add_symbols(ctx, hdlc_tx_flag_symbols, 8 * HDLC_TX_SYMBOL_BITS);
+}
+
+static inline void IRAM_ATTR hdlc_tx_add_byte(hdlc_tx_ctx_t *ctx, uint8_t c)
+{
+    const hdlc_tx_step_t step = hdlc_tx_table[ctx->one_count][c];
+    ctx->one_count = step.next_run;
+    hdlc_tx_add_symbols(ctx, step.symbols, step.len * HDLC_TX_SYMBOL_BITS);
+}
+
+/*** Pad with idle symbols to a word boundary, flushing the last word */
+static inline void IRAM_ATTR hdlc_tx_pad_to_word(hdlc_tx_ctx_t *ctx)
+{
+    if (ctx->acc_len)
+    {
+        hdlc_tx_add_symbols(ctx, 0, 32 - ctx->acc_len);
+    }
+}
+
+// Byte at a time HDLC receiver, driving hdlc_rx_table. It finds the frames,
+// destuffs them a byte at a time and watches for the line going idle,
+// leaving what to do with them to the hdlc_rx_ops_t callbacks.
+typedef enum
+{
+    HDLC_FRAME_NONE,   ///< Hunting for an opening flag
+    HDLC_FRAME_ACTIVE, ///< Receiving a frame
+    HDLC_FRAME_SKIP,   ///< Receiving a frame that isn't wanted, only tracked for the closing flag
+} hdlc_frame_state_t;
+
+typedef struct hdlc_rx
+{
+    uint8_t run;                ///< Run of 1s so far, see hdlc_rx_table
+    volatile uint8_t idle_ones; ///< Run of 1s towards idle, up to idle_bits
+    uint8_t frame_state;        ///< hdlc_frame_state_t
+    uint16_t frame_len;         ///< Bytes of the current frame kept so far
+    uint32_t data_shift;        ///< Destuffed bits not yet making up a byte
+    uint32_t data_bits;
+    uint32_t skip_bits; ///< Data bits of a frame being skipped, for its size
+} hdlc_rx_t;
+
+typedef struct
+{
+    uint32_t idle_bits; ///< Run of 1s that means the line has gone idle
+    uint32_t max_len;   ///< Frames reaching this many bytes are dropped
+    void (*begin)(hdlc_rx_t *rx);                 ///< Opening flag
+    bool (*add_byte)(hdlc_rx_t *rx, uint8_t c);   ///< Keep byte frame_len, false if there's no room
+    bool (*is_wanted)(hdlc_rx_t *rx);             ///< First two bytes kept, the rest can be skipped
+    void (*end)(hdlc_rx_t *rx);                   ///< Closing flag of a frame of two or more bytes
+    void (*skipped)(hdlc_rx_t *rx, uint32_t len); ///< Closing flag of a skipped frame of len bytes
+    void (*aborted)(hdlc_rx_t *rx);               ///< Abort after two or more bytes
+    void (*oversize)(hdlc_rx_t *rx);              ///< Frame dropped at max_len
+    void (*idle)(hdlc_rx_t *rx);                  ///< Line just gone idle
+} hdlc_rx_ops_t;
+
+void hdlc_rx_clk_byte(hdlc_rx_t *rx, const hdlc_rx_ops_t *ops, uint8_t c, bool is_line_held);
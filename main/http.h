@@ -15,7 +15,7 @@
 #include "cJSON.h"
 #include "esp_http_server.h"
 
-#define MAX_WS_BROADCAST_SIZE 1024
+#define MAX_WS_BROADCAST_SIZE 4096
 
 typedef esp_err_t (*ws_handler_fn)(httpd_req_t* req, int request_id, const cJSON *payload);
 
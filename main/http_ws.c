@@ -373,12 +373,18 @@ static esp_err_t _ws_save_econet_clock(httpd_req_t *req, int request_id, const c
     const cJSON *freq = cJSON_GetObjectItemCaseSensitive(settings, "internalFrequencyHz");
     const cJSON *duty = cJSON_GetObjectItemCaseSensitive(settings, "internalDutyCycle");
     const cJSON *invert = cJSON_GetObjectItemCaseSensitive(settings, "invertClock");
+    const cJSON *turnaround = cJSON_GetObjectItemCaseSensitive(settings, "turnaroundMs");
 
-    if (!cJSON_IsString(mode) || !cJSON_IsNumber(freq) || !cJSON_IsNumber(duty))
+    if (!cJSON_IsString(mode) || !cJSON_IsNumber(freq) || !cJSON_IsNumber(duty) || !cJSON_IsNumber(turnaround))
     {
         return send_err_response(req, request_id, "Missing or incorrect fields");
     }
 
+    if (turnaround->valueint < 1 || turnaround->valueint > 1000)
+    {
+        return send_err_response(req, request_id, "Unacceptable turnaround time");
+    }
+
     if (duty->valueint < 1 || duty->valueint > 100 || freq->valueint < 50000 || freq->valueint > 500000)
     {
         return send_err_response(req, request_id, "Unacceptable clock values");
@@ -389,6 +395,7 @@ static esp_err_t _ws_save_econet_clock(httpd_req_t *req, int request_id, const c
         .frequency_hz = freq->valueint,
         .duty_pc = duty->valueint,
         .invert_clock = cJSON_IsTrue(invert),
+        .turnaround_ms = turnaround->valueint,
     };
 
     config_set_econet_clock(&clock_cfg);
@@ -411,13 +418,15 @@ static esp_err_t _ws_get_econet_clock(httpd_req_t *req, int request_id, const cJ
              "\"mode\": \"%s\","
              "\"internalFrequencyHz\": %" PRIu32 ","
              "\"internalDutyCycle\": %" PRIu32 ","
-             "\"invertClock\": %s"
+             "\"invertClock\": %s,"
+             "\"turnaroundMs\": %" PRIu32
              "}}",
              request_id,
              clock_cfg.mode == ECONET_CLOCK_INTERNAL ? "internal" : "external",
              clock_cfg.frequency_hz,
              clock_cfg.duty_pc,
-             clock_cfg.invert_clock ? "true" : "false");
+             clock_cfg.invert_clock ? "true" : "false",
+             clock_cfg.turnaround_ms);
     return _ws_send(req, response);
 }
 
@@ -549,7 +558,8 @@ esp_err_t http_ws_handler(httpd_req_t *req)
 
 static void _async_send_worker(void *arg)
 {
-    uint8_t msg[MAX_WS_BROADCAST_SIZE];
+    // Too big for the httpd task stack. Only ever used from that task.
+    static uint8_t msg[MAX_WS_BROADCAST_SIZE];
 
     while (1)
     {
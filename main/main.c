@@ -73,6 +73,67 @@ void print_task_list(void)
     // free(buf);
 }
 
+/*** Format an array of counters as a JSON array */
+static void json_u32_array(char *buf, size_t size, const uint32_t *values, size_t count)
+{
+    size_t pos = snprintf(buf, size, "[");
+    for (size_t i = 0; i < count && pos < size; i++)
+    {
+        pos += snprintf(buf + pos, size - pos, i ? ",%lu" : "%lu", values[i]);
+    }
+    if (pos < size)
+    {
+        snprintf(buf + pos, size - pos, "]");
+    }
+}
+
+/*** Format rows of counters as a JSON array of arrays */
+static void json_u32_arrays(char *buf, size_t size, const uint32_t *values, size_t rows, size_t cols)
+{
+    size_t pos = snprintf(buf, size, "[");
+    for (size_t r = 0; r < rows && pos < size; r++)
+    {
+        if (r)
+        {
+            pos += snprintf(buf + pos, size - pos, ",");
+        }
+        if (pos < size)
+        {
+            json_u32_array(buf + pos, size - pos, values + r * cols, cols);
+            pos += strlen(buf + pos);
+        }
+    }
+    if (pos < size)
+    {
+        snprintf(buf + pos, size - pos, "]");
+    }
+}
+
+typedef struct
+{
+    char *buf;
+    size_t size;
+    size_t pos;
+} json_list_t;
+
+/*** Append an AUN peer's round trip stats to a JSON array, dropping any that don't fit */
+static void json_aun_peer(void *ctx, const aunbridge_peer_t *peer)
+{
+    json_list_t *list = ctx;
+    int len = snprintf(list->buf + list->pos, list->size - list->pos,
+                       "%s{\"name\":\"%s\",\"srtt_us\":%lu,\"rttvar_us\":%lu,\"rto_us\":%lu,\"rtt_max_us\":%lu,\"retry_count\":%lu}",
+                       list->pos > 1 ? "," : "", peer->name,
+                       peer->srtt_us, peer->rttvar_us, peer->rto_us, peer->rtt_max_us, peer->retry_count);
+    if (len > 0 && list->pos + len + 1 < list->size)
+    {
+        list->pos += len;
+    }
+    else
+    {
+        list->buf[list->pos] = '\0';
+    }
+}
+
 void app_main(void)
 {
     init_fs();
@@ -114,6 +175,35 @@ void app_main(void)
         aunbridge_stats_t aun = aunbridge_stats;
         econet_stats_t eco = econet_stats;
 
+        char ack_turnaround_hist[ECONET_ACK_HIST_BUCKETS * 11 + 3];
+        char frame_len_hist[ECONET_FRAME_HIST_BUCKETS * 11 + 3];
+        char tx_gap_hist[ECONET_TX_GAP_HIST_BUCKETS * 11 + 3];
+        char tx_queue_depth[ECONET_TX_CLASSES * 11 + 3];
+        char tx_queue_depth_peak[ECONET_TX_CLASSES * 11 + 3];
+        char tx_queue_wait_avg[ECONET_TX_CLASSES * 11 + 3];
+        char tx_queue_wait_max[ECONET_TX_CLASSES * 11 + 3];
+        char tx_phase_max[ECONET_TX_PHASES * 11 + 3];
+        static char tx_phase_hist[ECONET_TX_PHASES * (ECONET_TX_PHASE_HIST_BUCKETS * 11 + 3) + 3];
+        json_u32_array(ack_turnaround_hist, sizeof(ack_turnaround_hist), eco.tx_ack_turnaround_hist, ECONET_ACK_HIST_BUCKETS);
+        json_u32_array(frame_len_hist, sizeof(frame_len_hist), eco.rx_frame_len_hist, ECONET_FRAME_HIST_BUCKETS);
+        json_u32_array(tx_gap_hist, sizeof(tx_gap_hist), eco.tx_gap_hist, ECONET_TX_GAP_HIST_BUCKETS);
+        uint32_t wait_avg_us[ECONET_TX_CLASSES];
+        for (int c = 0; c < ECONET_TX_CLASSES; c++)
+        {
+            wait_avg_us[c] = eco.tx_queue_wait_count[c] ? eco.tx_queue_wait_total_us[c] / eco.tx_queue_wait_count[c] : 0;
+        }
+        json_u32_array(tx_queue_depth, sizeof(tx_queue_depth), eco.tx_queue_depth, ECONET_TX_CLASSES);
+        json_u32_array(tx_queue_depth_peak, sizeof(tx_queue_depth_peak), eco.tx_queue_depth_peak, ECONET_TX_CLASSES);
+        json_u32_array(tx_queue_wait_avg, sizeof(tx_queue_wait_avg), wait_avg_us, ECONET_TX_CLASSES);
+        json_u32_array(tx_queue_wait_max, sizeof(tx_queue_wait_max), eco.tx_queue_wait_max_us, ECONET_TX_CLASSES);
+        json_u32_arrays(tx_phase_hist, sizeof(tx_phase_hist), &eco.tx_phase_hist[0][0], ECONET_TX_PHASES, ECONET_TX_PHASE_HIST_BUCKETS);
+        json_u32_array(tx_phase_max, sizeof(tx_phase_max), eco.tx_phase_max_us, ECONET_TX_PHASES);
+        static char aun_peers[1024];
+        json_list_t aun_peer_list = {.buf = aun_peers, .size = sizeof(aun_peers), .pos = 1};
+        strcpy(aun_peers, "[");
+        aunbridge_foreach_peer(json_aun_peer, &aun_peer_list);
+        strcpy(aun_peers + aun_peer_list.pos, "]");
+
         int len = snprintf(buf, sizeof(buf),
                            "{"
                            "\"type\":\"stats_stream\","
@@ -132,7 +222,11 @@ void app_main(void)
                            "\"rx_nack_count\":%lu,"
                            "\"rx_unknown_count\":%lu,"
                            "\"rx_bridge_control\":%lu,"
-                           "\"rx_broadcast_count\":%lu"
+                           "\"rx_broadcast_count\":%lu,"
+                           "\"imm_cache_hit_count\":%lu,"
+                           "\"imm_cache_miss_count\":%lu,"
+                           "\"rx_drop_count\":%lu,"
+                           "\"peers\":%s"
                            "},"
                            "\"econet_stats\":{"
                            "\"rx_frame_count\":%lu,"
@@ -143,7 +237,37 @@ void app_main(void)
                            "\"rx_ack_count\":%lu,"
                            "\"rx_nack_count\":%lu,"
                            "\"tx_frame_count\":%lu,"
-                           "\"tx_ack_count\":%lu"
+                           "\"tx_ack_count\":%lu,"
+                           "\"rx_isr_count\":%lu,"
+                           "\"rx_ack_latency_avg_us\":%lu,"
+                           "\"rx_ack_latency_max_us\":%lu,"
+                           "\"rx_filtered_count\":%lu,"
+                           "\"rx_no_buffer_count\":%lu,"
+                           "\"rx_unpaired_count\":%lu,"
+                           "\"rx_idle_count\":%lu,"
+                           "\"rx_idle_signal_avg_cycles\":%lu,"
+                           "\"tx_ack_fast_count\":%lu,"
+                           "\"tx_ack_cache_hit_count\":%lu,"
+                           "\"tx_ack_cache_miss_count\":%lu,"
+                           "\"tx_ack_turnaround_hist\":%s,"
+                           "\"rx_line_busy_bits\":%llu,"
+                           "\"rx_line_idle_bits\":%llu,"
+                           "\"rx_line_util_pc\":%lu,"
+                           "\"rx_line_util_peak_pc\":%lu,"
+                           "\"rx_frame_len_hist\":%s,"
+                           "\"tx_underrun_count\":%lu,"
+                           "\"tx_gap_hist\":%s,"
+                           "\"tx_queue_depth\":%s,"
+                           "\"tx_queue_depth_peak\":%s,"
+                           "\"tx_queue_wait_avg_us\":%s,"
+                           "\"tx_queue_wait_max_us\":%s,"
+                           "\"tx_scout_retry_count\":%lu,"
+                           "\"tx_scout_collision_count\":%lu,"
+                           "\"tx_scout_defer_count\":%lu,"
+                           "\"tx_scout_giveup_count\":%lu,"
+                           "\"tx_phase_hist\":%s,"
+                           "\"tx_phase_max_us\":%s,"
+                           "\"rx_bit_clock_hz\":%lu"
                            "}"
                            "}",
                            aun.tx_count,
@@ -161,6 +285,10 @@ void app_main(void)
                            aun.rx_unknown_count,
                            aun.rx_bridge_control,
                            aun.rx_broadcast_count,
+                           aun.imm_cache_hit_count,
+                           aun.imm_cache_miss_count,
+                           aun.rx_drop_count,
+                           aun_peers,
                            eco.rx_frame_count,
                            eco.rx_crc_fail_count,
                            eco.rx_short_frame_count,
@@ -169,7 +297,37 @@ void app_main(void)
                            eco.rx_ack_count,
                            eco.rx_nack_count,
                            eco.tx_frame_count,
-                           eco.tx_ack_count);
+                           eco.tx_ack_count,
+                           eco.rx_isr_count,
+                           eco.rx_ack_latency_count ? eco.rx_ack_latency_total_us / eco.rx_ack_latency_count : 0,
+                           eco.rx_ack_latency_max_us,
+                           eco.rx_filtered_count,
+                           eco.rx_no_buffer_count,
+                           eco.rx_unpaired_count,
+                           eco.rx_idle_count,
+                           eco.rx_idle_count ? eco.rx_idle_signal_cycles / eco.rx_idle_count : 0,
+                           eco.tx_ack_fast_count,
+                           eco.tx_ack_cache_hit_count,
+                           eco.tx_ack_cache_miss_count,
+                           ack_turnaround_hist,
+                           eco.rx_line_busy_bits,
+                           eco.rx_line_idle_bits,
+                           eco.rx_line_util_pc,
+                           eco.rx_line_util_peak_pc,
+                           frame_len_hist,
+                           eco.tx_underrun_count,
+                           tx_gap_hist,
+                           tx_queue_depth,
+                           tx_queue_depth_peak,
+                           tx_queue_wait_avg,
+                           tx_queue_wait_max,
+                           eco.tx_scout_retry_count,
+                           eco.tx_scout_collision_count,
+                           eco.tx_scout_defer_count,
+                           eco.tx_scout_giveup_count,
+                           tx_phase_hist,
+                           tx_phase_max,
+                           eco.rx_bit_clock_hz);
 
         if (len > 0 && len < (int)sizeof(buf))
         {
@@ -15,8 +15,13 @@
 #include "esp_intr_alloc.h"
 #include "driver/gpio.h"
 #include "driver/parlio_tx.h"
+#include "hal/gdma_ll.h"
 #include "parlio_tx_econet_priv.h"
 
+// DMA channel behind the loop transmission, for parlio_tx_unit_loop_is_late()
+static gdma_dev_t *loop_dma_dev;
+static int loop_dma_channel;
+
 void parlio_tx_neg_edge(parlio_tx_unit_t *tx_unit)
 {
     int group_id = tx_unit->base.group->group_id;
@@ -25,7 +30,7 @@ void parlio_tx_neg_edge(parlio_tx_unit_t *tx_unit)
                                    parlio_periph_signals.groups[group_id].tx_units[unit_id].clk_in_sig, true);
 }
 
-static void parlio_mount_buffer(parlio_tx_unit_t *tx_unit, parlio_tx_trans_desc_t *t)
+static void IRAM_ATTR parlio_mount_buffer(parlio_tx_unit_t *tx_unit, parlio_tx_trans_desc_t *t)
 {
     // DMA transfer data based on bytes not bits, so convert the bit length to bytes, round up
     gdma_buffer_mount_config_t mount_config = {
@@ -144,6 +149,14 @@ void IRAM_ATTR parlio_tx_go(parlio_tx_unit_handle_t tx_unit)
     }
 }
 
+/*** Queue a transaction with the clock stopped.
+ *
+ * If the unit is idle the transaction is loaded straight away and its
+ * start is held in the FIFO until parlio_tx_go(). A loop transmission
+ * repeats its buffer until parlio_tx_unit_loop_append() chains the next one
+ * on, so a short buffer makes a fill that runs until the real data is
+ * ready.
+ */
 esp_err_t parlio_tx_unit_pretransmit(parlio_tx_unit_handle_t tx_unit, const void *payload, size_t payload_bits, const parlio_transmit_config_t *config)
 {
     ESP_RETURN_ON_FALSE(tx_unit && payload && payload_bits, ESP_ERR_INVALID_ARG, TAG, "invalid argument");
@@ -159,6 +172,12 @@ esp_err_t parlio_tx_unit_pretransmit(parlio_tx_unit_handle_t tx_unit, const void
         ESP_RETURN_ON_FALSE(parlio_ll_tx_support_dma_eof(NULL) || tx_unit->data_width > 1, ESP_ERR_NOT_SUPPORTED, TAG,
                             "1-bit data width loop transmission is not supported by this chip revision");
     }
+    if (config->flags.loop_transmission && loop_dma_dev == NULL)
+    {
+        int group_id;
+        ESP_RETURN_ON_ERROR(gdma_get_group_channel_id(tx_unit->dma_chan, &group_id, &loop_dma_channel), TAG, "get DMA channel failed");
+        loop_dma_dev = GDMA_LL_GET_HW(group_id);
+    }
 #else
     ESP_RETURN_ON_FALSE(config->flags.loop_transmission == false, ESP_ERR_NOT_SUPPORTED, TAG, "loop transmission is not supported on this chip");
 #endif
@@ -256,3 +275,45 @@ esp_err_t parlio_tx_unit_pretransmit(parlio_tx_unit_handle_t tx_unit, const void
 
     return ESP_OK;
 }
+
+/*** Chain the next buffer onto the running loop transmission.
+ *
+ * The DMA moves on to the new buffer when it finishes the current one, and
+ * on_buffer_switched is called. Only one buffer can be waiting at a time.
+ * Returns ESP_ERR_INVALID_STATE if the current transaction isn't a loop
+ * transmission (e.g. it's still queued behind another) or a buffer is
+ * already waiting. Also works on a loop transmission that's pretransmitted
+ * but not yet started. Safe to call from ISR context, including
+ * on_buffer_switched, as long as no task is inside the driver at the same
+ * time. The payload must be in internal RAM.
+ */
+esp_err_t IRAM_ATTR parlio_tx_unit_loop_append(parlio_tx_unit_handle_t tx_unit, const void *payload, size_t payload_bits)
+{
+    parlio_tx_trans_desc_t *t = tx_unit->cur_trans;
+    if (t == NULL || !t->flags.loop_transmission || atomic_load(&tx_unit->buffer_need_switch))
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    t->payload = payload;
+    t->payload_bits = payload_bits;
+    parlio_mount_buffer(tx_unit, t);
+    atomic_store(&tx_unit->buffer_need_switch, true);
+    return ESP_OK;
+}
+
+/*** Whether the DMA finished the buffer ahead of the one just chained on first.
+ *
+ * Call straight after parlio_tx_unit_loop_append(). If the DMA got to the
+ * end of the previous buffer before the new one was chained on, it's gone
+ * round that buffer again, so it's been sent (at least) twice. Every buffer
+ * marks EOF, so this is a matter of which descriptor did so last. Each
+ * buffer must fit in one descriptor. Errs on the side of reporting late if
+ * the DMA finishes the previous buffer just as this is called.
+ */
+bool IRAM_ATTR parlio_tx_unit_loop_is_late(parlio_tx_unit_handle_t tx_unit)
+{
+    parlio_tx_trans_desc_t *t = tx_unit->cur_trans;
+    uint32_t eof_desc = gdma_ll_tx_get_eof_desc_addr(loop_dma_dev, loop_dma_channel);
+    return eof_desc == (uint32_t)gdma_link_get_head_addr(tx_unit->dma_link[1 - t->dma_link_idx]);
+}
@@ -30,6 +30,11 @@ trunk_t trunks[3];
 uint8_t trunk_our_net;
 static int trunk_count = 0;
 
+// Frames for the trunk are put together and encrypted here, leaving the
+// queued frame as it is in case it has to go again. Only the AUN TX task
+// sends frames on trunks.
+static uint8_t trunk_tx_buffer[ECONET_MTU + 64];
+
 static bool _encrypt_and_send_using_workspace(trunk_t *trunk, uint8_t *data, size_t data_len, size_t data_capacity, size_t workspace_len)
 {
     if (workspace_len < CRYPT_WORKSPACE_SIZE)
@@ -145,69 +150,104 @@ void trunk_tick(void)
     }
 }
 
-bool trunk_tx_packet(econet_scout_t *scout, uint8_t *data, size_t data_length, size_t data_capacity, size_t workspace_length)
+/*** Send a packet from Econet over the trunk it was routed to */
+static bool _trunk_send(aunbridge_peer_t *peer, aunbridge_tx_t *tx)
+{
+    trunk_t *trunk = peer->ctx;
+    const uint8_t *frame = tx->pkt.data + ECONET_RX_BUFFER_WORKSPACE;
+    uint8_t *trunk_packet = trunk_tx_buffer + CRYPT_WORKSPACE_SIZE;
+    trunk_hdr_t hdr = {
+        .transaction_type = AUN_TYPE_DATA,
+        .ecohdr.dst_net = tx->scout.hdr.dst_net,
+        .ecohdr.dst_stn = tx->scout.hdr.dst_stn,
+        .ecohdr.src_net = trunk_our_net,
+        .ecohdr.src_stn = tx->scout.hdr.src_stn,
+        .control = tx->scout.control,
+        .port = tx->scout.port,
+        .padding = 0,
+        .sequence = tx->seq,
+    };
+
+    // Trunk header in place of the Econet one
+    size_t payload_len = tx->pkt.length - sizeof(econet_hdr_t);
+    size_t capacity = sizeof(trunk_tx_buffer) - CRYPT_WORKSPACE_SIZE;
+    if (sizeof(hdr) + payload_len + 16 > capacity)
+    {
+        ESP_LOGE(TAG, "Frame of %u bytes too big for the trunk", tx->pkt.length);
+        return false;
+    }
+    memcpy(trunk_packet, &hdr, sizeof(hdr));
+    memcpy(trunk_packet + sizeof(hdr), frame + sizeof(econet_hdr_t), payload_len);
+
+    return _encrypt_and_send_using_workspace(trunk, trunk_packet, sizeof(hdr) + payload_len, capacity, CRYPT_WORKSPACE_SIZE);
+}
+
+aunbridge_peer_t *trunk_route(const econet_scout_t *scout)
 {
     // Local net not handled by trunk.
     // TODO: Bridge queries
     if (scout->hdr.dst_net == 0 || scout->hdr.dst_net == trunk_our_net)
     {
-        return false;
+        return NULL;
     }
 
     // Find trunk where we can send this
-    trunk_t *trunk = NULL;
     for (int i = 0; i < ARRAY_SIZE(trunks); i++)
     {
-        if (bm256_test(&trunks[i].nets, scout->hdr.dst_net))
+        if (trunks[i].is_open && bm256_test(&trunks[i].nets, scout->hdr.dst_net))
         {
-            trunk = &trunks[i];
-            break;
+            return &trunks[i].peer;
         }
     }
-    if (trunk == NULL)
+    return NULL;
+}
+
+/*** Send the far end of a trunk the result of delivering its frame on Econet */
+static void _trunk_send_ack(trunk_t *trunk, trunk_hdr_t hdr, econet_acktype_t result, const uint8_t *imm_reply, uint16_t imm_reply_len)
+{
+    switch (result)
     {
-        return false;
+    case ECONET_ACK:
+        hdr.transaction_type = AUN_TYPE_ACK;
+        aunbridge_stats.tx_ack_count++;
+        break;
+    case ECONET_IMM_REPLY:
+        hdr.transaction_type = AUN_TYPE_IMM_REPLY;
+        aunbridge_stats.tx_ack_count++;
+        break;
+    default:
+        hdr.transaction_type = AUN_TYPE_NACK;
+        aunbridge_stats.tx_nack_count++;
     }
 
-    uint8_t *trunk_packet = data - sizeof(trunk_hdr_t) + 4;
-    int retries = 5;
-    trunk->seq += 4;
-    while (--retries > 0)
+    // Send (N)ACK
+    econet_swap_addresses(&hdr.ecohdr);
+    uint8_t *packet = udp_rx_buffer + CRYPT_WORKSPACE_SIZE;
+    memcpy(packet, &hdr, sizeof(hdr));
+    if (imm_reply != NULL)
     {
-        trunk_hdr_t hdr = {
-            .transaction_type = AUN_TYPE_DATA,
-            .ecohdr.dst_net = scout->hdr.dst_net,
-            .ecohdr.dst_stn = scout->hdr.dst_stn,
-            .ecohdr.src_net = trunk_our_net,
-            .ecohdr.src_stn = scout->hdr.src_stn,
-            .control = scout->control,
-            .port = scout->port,
-            .padding = 0,
-            .sequence = trunk->seq,
-        };
-        memcpy(trunk_packet, &hdr, sizeof(hdr));
-
-        _encrypt_and_send_using_workspace(trunk,
-                                          trunk_packet, data_length + sizeof(hdr) - 4,
-                                          data_capacity + sizeof(hdr) - 4,
-                                          ECONET_RX_BUFFER_WORKSPACE - sizeof(trunk_hdr_t) + 4);
-
-        if (aunbridge_wait_ack(trunk->seq))
-        {
-            break;
-        }
-
-        aunbridge_stats.tx_retry_count++;
-        ESP_LOGI(TAG, "Retry! %d remain", retries - 1);
+        memcpy(packet + sizeof(hdr), imm_reply, imm_reply_len);
     }
-
-    if (retries == 0)
+    else
     {
-        ESP_LOGW(TAG, "Retries exhausted, no response from bridge");
-        aunbridge_stats.tx_abort_count++;
+        imm_reply_len = 0;
     }
+    _encrypt_and_send_using_workspace(trunk, packet, sizeof(hdr) + imm_reply_len, sizeof(udp_rx_buffer) - CRYPT_WORKSPACE_SIZE, CRYPT_WORKSPACE_SIZE);
+}
 
-    return true;
+/*** Answer the far end of a trunk now its frame has been delivered on Econet */
+static void _trunk_delivered(aunbridge_delivery_t *delivery)
+{
+    trunk_t *trunk = delivery->from;
+    trunk_hdr_t hdr;
+    memcpy(&hdr, delivery->hdr, sizeof(hdr));
+
+    trunk->deliveries--;
+    trunk->last_tx_result = delivery->result;
+    trunk->last_acked_seq = hdr.sequence;
+
+    _trunk_send_ack(trunk, hdr, delivery->result,
+                    delivery->result == ECONET_IMM_REPLY ? delivery->imm_reply : NULL, delivery->imm_reply_len);
 }
 
 void trunk_rx_process(trunk_t *trunk)
@@ -277,11 +317,11 @@ void trunk_rx_process(trunk_t *trunk)
         break;
     case AUN_TYPE_ACK:
         aunbridge_stats.rx_ack_count++;
-        aunbridge_signal_ack(hdr.sequence);
+        aunbridge_signal_ack(&trunk->peer, hdr.sequence, false);
         return;
     case AUN_TYPE_NACK:
         aunbridge_stats.rx_nack_count++;
-        aunbridge_signal_ack(hdr.sequence);
+        aunbridge_signal_ack(&trunk->peer, hdr.sequence, true);
         return;
     default:
         ESP_LOGW(TAG, "Received packet of unknown type 0x%02x. Ignored.", udp_rx_buffer[0]);
@@ -317,53 +357,41 @@ void trunk_rx_process(trunk_t *trunk)
 
     // Send to Beeb (but only if we didn't get acknowledgement before for this packet.)
     // NOTE: We're not encountering out of order but if we do then we'll need a different strategy to reorder them.
-    uint8_t *imm_reply = NULL;
-    uint16_t imm_reply_len;
+    if (trunk->deliveries > 0 && hdr.sequence == trunk->delivering_seq)
+    {
+        ESP_LOGI(TAG, "[%05d] Ignoring duplicate still being delivered", hdr.sequence);
+        return;
+    }
     if (hdr.sequence != trunk->last_acked_seq || trunk->last_tx_result == ECONET_NACK || trunk->last_tx_result == ECONET_IMM_REPLY)
     {
+        aunbridge_delivery_t *delivery = aunbridge_delivery_alloc(len);
+        if (delivery == NULL)
+        {
+            ESP_LOGW(TAG, "[%05d] Too many frames waiting for Econet. Dropped.", hdr.sequence);
+            return;
+        }
+
         ESP_LOGI(TAG, "[%05d] Delivering %d byte frame from %d.%d to Econet %d.%d (P0x%x C0x%x)",
                  hdr.sequence, len,
                  hdr.ecohdr.src_net, hdr.ecohdr.src_stn,
                  hdr.ecohdr.dst_net, hdr.ecohdr.dst_stn,
                  hdr.port, hdr.control);
 
-        trunk->last_tx_result = econet_send(payload, len, &imm_reply, &imm_reply_len);
-        trunk->last_acked_seq = hdr.sequence;
-    }
-    else
-    {
-        ESP_LOGI(TAG, "[%05d] Re-acknowledging duplicate (Econet ack was %d)", hdr.sequence, trunk->last_tx_result);
-    }
-
-    // Send AUN ack/nack
-    switch (trunk->last_tx_result)
-    {
-    case ECONET_ACK:
-        hdr.transaction_type = AUN_TYPE_ACK;
-        aunbridge_stats.tx_ack_count++;
-        break;
-    case ECONET_IMM_REPLY:
-        hdr.transaction_type = AUN_TYPE_IMM_REPLY;
-        aunbridge_stats.tx_ack_count++;
-        break;
-    default:
-        hdr.transaction_type = AUN_TYPE_NACK;
-        aunbridge_stats.tx_nack_count++;
+        // Trunks take TX source ids down from the top, AUN stations up from 0.
+        // The (N)ACK is sent once the frame has been delivered.
+        memcpy(delivery->frame, payload, len);
+        memcpy(delivery->hdr, &hdr, sizeof(hdr));
+        delivery->done = _trunk_delivered;
+        delivery->from = trunk;
+        delivery->tx_source = ECONET_TX_SOURCES - 1 - (trunk - trunks);
+        trunk->deliveries++;
+        trunk->delivering_seq = hdr.sequence;
+        aunbridge_deliver(delivery);
+        return;
     }
 
-    // Send (N)ACK
-    econet_swap_addresses(&hdr.ecohdr);
-    uint8_t *packet = udp_rx_buffer + CRYPT_WORKSPACE_SIZE;
-    memcpy(packet, &hdr, sizeof(hdr));
-    if (imm_reply != NULL)
-    {
-        memcpy(packet + sizeof(hdr), imm_reply, imm_reply_len);
-    }
-    else
-    {
-        imm_reply_len = 0;
-    }
-    _encrypt_and_send_using_workspace(trunk, packet, sizeof(hdr) + imm_reply_len, sizeof(udp_rx_buffer) - CRYPT_WORKSPACE_SIZE, CRYPT_WORKSPACE_SIZE);
+    ESP_LOGI(TAG, "[%05d] Re-acknowledging duplicate (Econet ack was %d)", hdr.sequence, trunk->last_tx_result);
+    _trunk_send_ack(trunk, hdr, trunk->last_tx_result, NULL, 0);
 }
 
 static void _setup_trunk(void *ctx, const config_trunk_t *cfg)
@@ -398,6 +426,9 @@ static void _setup_trunk(void *ctx, const config_trunk_t *cfg)
     }
 
     trunk->is_open = true;
+    trunk->peer.send = _trunk_send;
+    trunk->peer.ctx = trunk;
+    snprintf(trunk->peer.name, sizeof(trunk->peer.name), "%s:%d", trunk->remote_address, trunk->remote_udp_port);
     trunk->last_acked_seq = 1;
     trunk->time_to_next_update = 1;
 
@@ -13,6 +13,7 @@
 #pragma once
 
 #include "econet.h"
+#include "aun_bridge.h"
 
 #define BRIDGE_PORT 0x9C
 #define BRIDGE_KEEPALIVE 0xD0
@@ -23,14 +24,16 @@
 
 typedef struct
 {
+    aunbridge_peer_t peer;
     char remote_address[64];
     uint8_t key[32];
     int socket;
     bool is_open;
-    uint32_t seq;
     uint16_t remote_udp_port;
     uint32_t last_acked_seq;
     econet_acktype_t last_tx_result;
+    uint8_t deliveries;      ///< Frames from this trunk waiting for or in delivery
+    uint32_t delivering_seq; ///< Sequence number of the last of them
     uint16_t time_to_next_update;
     bitmap256_t nets;
 } trunk_t;
@@ -48,7 +51,7 @@ typedef struct
     uint32_t sequence;
 } trunk_hdr_t;
 
-bool trunk_tx_packet(econet_scout_t *scout, uint8_t *data, size_t data_length, size_t data_capacity, size_t workspace_length);
+aunbridge_peer_t *trunk_route(const econet_scout_t *scout);
 void trunk_rx_process(trunk_t *trunk);
 void trunk_tick(void);
 void trunk_reconfigure(void);
@@ -49,3 +49,13 @@ ALWAYS_INLINE void bm256_reset(volatile bitmap256_t *bm)
         bm->w[i] = 0;
     }
 }
+
+/*** Histogram bucket for v where bucket n holds values below 2^n.
+ *
+ * Bucket 0 is v == 0, the last bucket holds everything that doesn't fit.
+ */
+ALWAYS_INLINE uint32_t log2_bucket(uint32_t v, uint32_t buckets)
+{
+    uint32_t n = v ? 32 - __builtin_clz(v) : 0;
+    return n < buckets ? n : buckets - 1;
+}
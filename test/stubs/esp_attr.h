@@ -0,0 +1,19 @@
+/*
+ * EconetWiFi
+ * Copyright (c) 2025 Paul G. Banks <https://paulbanks.org/projects/econet>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * See the LICENSE file in the project root for full license information.
+ */
+
+// Host stand-in for ESP-IDF's esp_attr.h. Memory placement doesn't matter
+// off target.
+
+#pragma once
+
+#define DRAM_ATTR
+#define IRAM_ATTR
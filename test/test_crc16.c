@@ -0,0 +1,176 @@
+/*
+ * EconetWiFi
+ * Copyright (c) 2025 Paul G. Banks <https://paulbanks.org/projects/econet>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * See the LICENSE file in the project root for full license information.
+ */
+
+// Checks the table driven CRC-16/X.25 variants against the bit at a time
+// calculation the frame encoder used to do.
+
+#include <string.h>
+#include <time.h>
+
+#include "test_util.h"
+#include "crc16.h"
+
+#define BENCH_FRAME 8192
+
+static uint16_t _ref_crc16_x25_update(uint16_t crc, const uint8_t *data, size_t len)
+{
+    for (size_t i = 0; i < len; i++)
+    {
+        crc ^= data[i];
+        for (int j = 0; j < 8; j++)
+        {
+            crc = (crc & 0x0001) ? (uint16_t)((crc >> 1) ^ 0x8408)
+                                 : (uint16_t)(crc >> 1);
+        }
+    }
+    return crc;
+}
+
+static void _test_check_value(void)
+{
+    // Standard check value for CRC-16/X.25
+    const char *check = "123456789";
+    CHECK(crc16_x25((const uint8_t *)check, 9) == 0x906E, "got 0x%04x", crc16_x25((const uint8_t *)check, 9));
+}
+
+static void _test_lengths_and_alignments(void)
+{
+    static uint8_t buf[1024 + 8];
+    for (size_t i = 0; i < sizeof(buf); i++)
+    {
+        buf[i] = test_rand();
+    }
+
+    for (size_t offset = 0; offset < 8; offset++)
+    {
+        for (size_t len = 0; len <= 1024; len += (len < 64 ? 1 : 37))
+        {
+            const uint8_t *data = buf + offset;
+            uint16_t init = test_rand();
+            uint16_t ref = _ref_crc16_x25_update(init, data, len);
+
+            uint16_t table = crc16_x25_update_table(init, data, len);
+            uint16_t slice4 = crc16_x25_update_slice4(init, data, len);
+            CHECK(table == ref, "table offset=%zu len=%zu: 0x%04x vs 0x%04x", offset, len, table, ref);
+            CHECK(slice4 == ref, "slice4 offset=%zu len=%zu: 0x%04x vs 0x%04x", offset, len, slice4, ref);
+
+            uint16_t fcs_ref = _ref_crc16_x25_update(CRC16_X25_INIT, data, len) ^ 0xFFFF;
+            CHECK(crc16_x25(data, len) == fcs_ref, "fcs offset=%zu len=%zu", offset, len);
+
+            // Byte at a time, as the RX deframer runs it
+            uint16_t bytewise = init;
+            for (size_t i = 0; i < len; i++)
+            {
+                bytewise = crc16_x25_update(bytewise, data[i]);
+            }
+            CHECK(bytewise == ref, "bytewise offset=%zu len=%zu", offset, len);
+        }
+    }
+}
+
+static void _test_split_runs(void)
+{
+    // The TX streamer carries the CRC between chunks of any length
+    static uint8_t buf[600];
+    for (size_t i = 0; i < sizeof(buf); i++)
+    {
+        buf[i] = test_rand();
+    }
+    uint16_t ref = _ref_crc16_x25_update(CRC16_X25_INIT, buf, sizeof(buf));
+    for (int n = 0; n < 200; n++)
+    {
+        uint16_t crc = CRC16_X25_INIT;
+        size_t pos = 0;
+        while (pos < sizeof(buf))
+        {
+            size_t len = test_rand() % 23;
+            if (len > sizeof(buf) - pos)
+            {
+                len = sizeof(buf) - pos;
+            }
+            crc = crc16_x25_update_slice4(crc, buf + pos, len);
+            pos += len;
+        }
+        CHECK(crc == ref, "split run %d: 0x%04x vs 0x%04x", n, crc, ref);
+    }
+}
+
+static void _test_residue(void)
+{
+    // A frame followed by its FCS leaves the register at the residue the
+    // RX deframer checks for
+    uint8_t frame[40];
+    for (size_t i = 0; i < sizeof(frame) - 2; i++)
+    {
+        frame[i] = test_rand();
+    }
+    uint16_t fcs = crc16_x25(frame, sizeof(frame) - 2);
+    frame[sizeof(frame) - 2] = fcs & 0xFF;
+    frame[sizeof(frame) - 1] = fcs >> 8;
+    uint16_t crc = crc16_x25_update_table(CRC16_X25_INIT, frame, sizeof(frame));
+    CHECK(crc == CRC16_X25_RESIDUE, "residue 0x%04x", crc);
+}
+
+static double _seconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*** Not a pass/fail check, just to show what each variant costs on this host */
+static void _bench_crc(void)
+{
+    static uint8_t frame[BENCH_FRAME];
+    for (size_t i = 0; i < sizeof(frame); i++)
+    {
+        frame[i] = test_rand();
+    }
+
+    // Summed so the compiler can't drop the calls
+    const int rounds = 200;
+    volatile uint16_t sink = 0;
+    double start = _seconds();
+    for (int i = 0; i < rounds; i++)
+    {
+        sink += _ref_crc16_x25_update(CRC16_X25_INIT, frame, sizeof(frame));
+    }
+    double ref_s = _seconds() - start;
+
+    start = _seconds();
+    for (int i = 0; i < rounds; i++)
+    {
+        sink += crc16_x25_update_table(CRC16_X25_INIT, frame, sizeof(frame));
+    }
+    double table_s = _seconds() - start;
+
+    start = _seconds();
+    for (int i = 0; i < rounds; i++)
+    {
+        sink += crc16_x25_update_slice4(CRC16_X25_INIT, frame, sizeof(frame));
+    }
+    double slice4_s = _seconds() - start;
+
+    printf("CRC over a %d byte frame: %.1f us bit at a time, %.1f us table, %.1f us slice-by-4\n",
+           BENCH_FRAME, ref_s * 1e6 / rounds, table_s * 1e6 / rounds, slice4_s * 1e6 / rounds);
+}
+
+int main(void)
+{
+    crc16_x25_init();
+    _test_check_value();
+    _test_lengths_and_alignments();
+    _test_split_runs();
+    _test_residue();
+    _bench_crc();
+    return test_result("test_crc16");
+}
@@ -0,0 +1,153 @@
+/*
+ * EconetWiFi
+ * Copyright (c) 2025 Paul G. Banks <https://paulbanks.org/projects/econet>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * See the LICENSE file in the project root for full license information.
+ */
+
+// Checks the egress scheduler puts immediate operations first, keeps each
+// source's frames in order and shares the line fairly between sources
+// whatever size of frame they send.
+
+#include <string.h>
+
+#include "test_util.h"
+#include "econet_tx_sched.h"
+
+#define POOL_SIZE 32768
+
+typedef struct
+{
+    econet_tx_sched_entry_t sched; ///< Kept first, as in tx_slot_t
+    uint32_t seq;                  ///< Order queued within its source
+} entry_t;
+
+static entry_t pool[POOL_SIZE];
+static int pool_used;
+static uint32_t next_seq[ECONET_TX_SOURCES];
+
+static entry_t *_queue(econet_tx_sched_t *sched, int tx_class, int source, int cost)
+{
+    entry_t *e = &pool[pool_used++ % POOL_SIZE];
+    e->sched.tx_class = tx_class;
+    e->sched.source = source;
+    e->sched.cost = cost;
+    e->seq = next_seq[source]++;
+    econet_tx_sched_enqueue(sched, &e->sched);
+    return e;
+}
+
+static void _test_imm_first(void)
+{
+    econet_tx_sched_t sched = {};
+    _queue(&sched, ECONET_TX_CLASS_DATA, 3, 100);
+    entry_t *imm1 = _queue(&sched, ECONET_TX_CLASS_IMM, 0, 10);
+    _queue(&sched, ECONET_TX_CLASS_DATA, 4, 100);
+    entry_t *imm2 = _queue(&sched, ECONET_TX_CLASS_IMM, 5, 10);
+
+    CHECK(econet_tx_sched_dequeue(&sched) == &imm1->sched, "first immediate operation");
+    CHECK(econet_tx_sched_dequeue(&sched) == &imm2->sched, "second immediate operation");
+    CHECK(econet_tx_sched_dequeue(&sched)->source == 3, "then data in turn order");
+    CHECK(econet_tx_sched_dequeue(&sched)->source == 4, "then data in turn order");
+    CHECK(econet_tx_sched_dequeue(&sched) == NULL, "empty");
+}
+
+/*** Keep every source backlogged and compare the bytes each gets sent */
+static void _test_fairness(void)
+{
+    // Sources sending small, medium, big and mixed frames
+    static const int sizes[][2] = {{20, 20}, {300, 300}, {1500, 1500}, {8200, 8200}, {10, 4000}};
+    const int nsources = sizeof(sizes) / sizeof(sizes[0]);
+    const int backlog = 8;
+
+    econet_tx_sched_t sched = {};
+    memset(next_seq, 0, sizeof(next_seq));
+    uint64_t sent[ECONET_TX_SOURCES] = {};
+    uint32_t expected_seq[ECONET_TX_SOURCES] = {};
+
+    for (int s = 0; s < nsources; s++)
+    {
+        for (int i = 0; i < backlog; i++)
+        {
+            _queue(&sched, ECONET_TX_CLASS_DATA, s, sizes[s][0] + test_rand() % (sizes[s][1] - sizes[s][0] + 1));
+        }
+    }
+
+    uint64_t total = 0;
+    for (int n = 0; n < 20000; n++)
+    {
+        entry_t *e = (entry_t *)econet_tx_sched_dequeue(&sched);
+        if (e == NULL)
+        {
+            CHECK(0, "ran dry with every source backlogged");
+            return;
+        }
+        int s = e->sched.source;
+        CHECK(e->seq == expected_seq[s], "source %d out of order: %u vs %u", s, e->seq, expected_seq[s]);
+        expected_seq[s] = e->seq + 1;
+        sent[s] += e->sched.cost;
+        total += e->sched.cost;
+
+        // Top it back up so it never runs dry
+        _queue(&sched, ECONET_TX_CLASS_DATA, s, sizes[s][0] + test_rand() % (sizes[s][1] - sizes[s][0] + 1));
+    }
+
+    // Each should get its share to within a quantum and a frame
+    uint64_t share = total / nsources;
+    for (int s = 0; s < nsources; s++)
+    {
+        uint64_t slack = ECONET_TX_DRR_QUANTUM + sizes[s][1] + 8200;
+        uint64_t diff = sent[s] > share ? sent[s] - share : share - sent[s];
+        CHECK(diff <= slack, "source %d sent %llu bytes, fair share %llu", s,
+              (unsigned long long)sent[s], (unsigned long long)share);
+        printf("source %d (%d-%d byte frames): %.1f%% of bytes\n", s, sizes[s][0], sizes[s][1], 100.0 * sent[s] / total);
+    }
+}
+
+/*** Frames given up on drop out, and the rest still take their turns */
+static void _test_unlink(void)
+{
+    econet_tx_sched_t sched = {};
+    memset(next_seq, 0, sizeof(next_seq));
+    entry_t *a0 = _queue(&sched, ECONET_TX_CLASS_DATA, 1, 100);
+    entry_t *a1 = _queue(&sched, ECONET_TX_CLASS_DATA, 1, 100);
+    entry_t *b0 = _queue(&sched, ECONET_TX_CLASS_DATA, 2, 100);
+    entry_t *c0 = _queue(&sched, ECONET_TX_CLASS_DATA, 3, 100);
+    entry_t *imm = _queue(&sched, ECONET_TX_CLASS_IMM, 0, 10);
+
+    // Tail of a flow, a whole flow in the middle of the round, and the only
+    // immediate operation
+    econet_tx_sched_unlink(&sched, &a1->sched);
+    econet_tx_sched_unlink(&sched, &b0->sched);
+    econet_tx_sched_unlink(&sched, &imm->sched);
+    CHECK(sched.drr_count == 2, "%d sources still active", sched.drr_count);
+
+    CHECK(econet_tx_sched_dequeue(&sched) == &a0->sched, "a0 next");
+    CHECK(econet_tx_sched_dequeue(&sched) == &c0->sched, "c0 next");
+    CHECK(econet_tx_sched_dequeue(&sched) == NULL, "nothing left");
+    CHECK(sched.imm_head == NULL && sched.imm_tail == NULL, "immediate queue empty");
+
+    // Sources can rejoin once emptied, and the head of the round can go
+    entry_t *d0 = _queue(&sched, ECONET_TX_CLASS_DATA, 4, 2000);
+    entry_t *e0 = _queue(&sched, ECONET_TX_CLASS_DATA, 5, 100);
+    CHECK(econet_tx_sched_dequeue(&sched) == &e0->sched, "e0 goes while d0 builds credit");
+    econet_tx_sched_unlink(&sched, &d0->sched);
+    CHECK(econet_tx_sched_dequeue(&sched) == NULL, "nothing left after d0 unlinked");
+    CHECK(sched.drr_count == 0, "%d sources still active", sched.drr_count);
+
+    entry_t *f0 = _queue(&sched, ECONET_TX_CLASS_DATA, 4, 100);
+    CHECK(econet_tx_sched_dequeue(&sched) == &f0->sched, "source 4 back in the round");
+}
+
+int main(void)
+{
+    _test_imm_first();
+    _test_fairness();
+    _test_unlink();
+    return test_result("test_econet_sched");
+}
@@ -0,0 +1,664 @@
+/*
+ * EconetWiFi
+ * Copyright (c) 2025 Paul G. Banks <https://paulbanks.org/projects/econet>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * See the LICENSE file in the project root for full license information.
+ */
+
+// Checks the table driven HDLC deframer and bit stuffer against the bit at
+// a time code they replaced: the deframer econet_rx.c drives on random and
+// flag/abort heavy bitstreams, the stuffer on every table entry and on
+// whole frames.
+
+#include <string.h>
+#include <stdbool.h>
+#include <time.h>
+
+#include "test_util.h"
+#include "crc16.h"
+#include "hdlc.h"
+
+#define IDLE_BITS 15
+#define MTU 64  // Small, so oversize frames come up often
+#define ROOM 40 // Where some frames run out of buffer
+#define LOG_MAX 65536
+#define STREAM_MAX 4096
+#define BENCH_FRAME 8192
+
+// What a deframer saw, in order
+#define LOG_FRAME 'F'    // Followed by the length then the bytes
+#define LOG_ABORT 'X'    // Followed by the length so far
+#define LOG_SKIPPED 'S' // Followed by the length
+#define LOG_OVERSIZE 'O'
+#define LOG_IDLE 'I'
+
+typedef struct
+{
+    uint32_t entries[LOG_MAX];
+    size_t len;
+} rx_log_t;
+
+static void _log(rx_log_t *log, uint32_t v)
+{
+    if (log->len < LOG_MAX)
+    {
+        log->entries[log->len++] = v;
+    }
+}
+
+static void _log_frame(rx_log_t *log, const uint8_t *buf, uint32_t len)
+{
+    _log(log, LOG_FRAME);
+    _log(log, len);
+    for (uint32_t i = 0; i < len; i++)
+    {
+        _log(log, buf[i]);
+    }
+}
+
+/*** Frames to some stations are skipped once their address is in */
+static bool _is_wanted(const uint8_t *buf)
+{
+    return (buf[0] & 7) != 0;
+}
+
+/*** Some frames run out of buffer part way through */
+static bool _is_out_of_room(const uint8_t *buf, uint32_t len)
+{
+    return len == ROOM && (buf[1] & 3) == 0;
+}
+
+/*** Bit at a time deframer, as econet_rx.c had before the table */
+typedef struct
+{
+    rx_log_t log;
+    uint8_t raw_shift_in;
+    bool is_frame_active;
+    bool is_skipping;
+    uint8_t data_shift_in;
+    uint32_t data_bit;
+    uint8_t buf[MTU];
+    uint32_t frame_len;
+    uint32_t frame_bits; ///< Every data bit, kept or skipped
+    uint32_t idle_one_counter;
+} ref_rx_t;
+
+static void _ref_begin_frame(ref_rx_t *rx)
+{
+    rx->is_frame_active = true;
+    rx->is_skipping = false;
+    rx->frame_len = 0;
+    rx->frame_bits = 0;
+    rx->data_bit = 0;
+    rx->data_shift_in = 0;
+}
+
+static void _ref_clk_bit(ref_rx_t *rx, uint8_t c, bool is_line_held)
+{
+    if (is_line_held)
+    {
+        rx->idle_one_counter = 0;
+    }
+    else if (c)
+    {
+        if (rx->idle_one_counter < IDLE_BITS)
+        {
+            rx->idle_one_counter++;
+            if (rx->idle_one_counter == IDLE_BITS)
+            {
+                _log(&rx->log, LOG_IDLE);
+            }
+        }
+    }
+    else
+    {
+        rx->idle_one_counter = 0;
+    }
+
+    rx->raw_shift_in = (rx->raw_shift_in << 1) | c;
+
+    // Search for flag
+    if (rx->raw_shift_in == 0x7e)
+    {
+        if (!rx->is_frame_active || rx->frame_len <= 1)
+        {
+            _ref_begin_frame(rx);
+        }
+        else if (rx->is_skipping)
+        {
+            rx->is_frame_active = false;
+            _log(&rx->log, LOG_SKIPPED);
+            _log(&rx->log, rx->frame_bits / 8);
+        }
+        else
+        {
+            rx->is_frame_active = false;
+            _log_frame(&rx->log, rx->buf, rx->frame_len);
+        }
+        return;
+    }
+
+    if (!rx->is_frame_active)
+    {
+        return;
+    }
+
+    // Search for ABORT
+    if (rx->raw_shift_in == 0x7f)
+    {
+        rx->is_frame_active = false;
+        if (rx->frame_len > 1)
+        {
+            _log(&rx->log, LOG_ABORT);
+            _log(&rx->log, rx->frame_len);
+        }
+        return;
+    }
+
+    // Bit stuffing
+    if ((rx->raw_shift_in & 0x3f) == 0x3e)
+    {
+        return;
+    }
+
+    rx->frame_bits++;
+    if (rx->is_skipping)
+    {
+        return;
+    }
+
+    // Data is LSB first
+    rx->data_shift_in = (rx->data_shift_in >> 1) | (c << 7);
+    rx->data_bit += 1;
+    if (rx->data_bit == 8)
+    {
+        if (_is_out_of_room(rx->buf, rx->frame_len))
+        {
+            rx->is_skipping = true;
+            return;
+        }
+        rx->buf[rx->frame_len++] = rx->data_shift_in;
+        if (rx->frame_len == 2 && !_is_wanted(rx->buf))
+        {
+            rx->is_skipping = true;
+            return;
+        }
+        if (rx->frame_len == MTU)
+        {
+            rx->is_frame_active = false;
+            _log(&rx->log, LOG_OVERSIZE);
+            return;
+        }
+        rx->data_bit = 0;
+    }
+}
+
+static void _ref_clk_byte(ref_rx_t *rx, uint8_t c, bool is_line_held)
+{
+    for (int i = 0; i < 8; i++)
+    {
+        _ref_clk_bit(rx, (c & 0x80) >> 7, is_line_held);
+        c <<= 1;
+    }
+}
+
+/*** The byte at a time deframer econet_rx.c drives, logging what it finds */
+typedef struct
+{
+    hdlc_rx_t hdlc; ///< Kept first, as the callbacks are handed this
+    rx_log_t log;
+    uint8_t buf[MTU];
+} tab_rx_t;
+
+static void _tab_begin(hdlc_rx_t *hdlc)
+{
+}
+
+static bool _tab_add_byte(hdlc_rx_t *hdlc, uint8_t c)
+{
+    tab_rx_t *rx = (tab_rx_t *)hdlc;
+    if (_is_out_of_room(rx->buf, hdlc->frame_len))
+    {
+        return false;
+    }
+    rx->buf[hdlc->frame_len] = c;
+    return true;
+}
+
+static bool _tab_is_wanted(hdlc_rx_t *hdlc)
+{
+    return _is_wanted(((tab_rx_t *)hdlc)->buf);
+}
+
+static void _tab_end(hdlc_rx_t *hdlc)
+{
+    tab_rx_t *rx = (tab_rx_t *)hdlc;
+    _log_frame(&rx->log, rx->buf, hdlc->frame_len);
+}
+
+static void _tab_skipped(hdlc_rx_t *hdlc, uint32_t len)
+{
+    tab_rx_t *rx = (tab_rx_t *)hdlc;
+    _log(&rx->log, LOG_SKIPPED);
+    _log(&rx->log, len);
+}
+
+static void _tab_aborted(hdlc_rx_t *hdlc)
+{
+    tab_rx_t *rx = (tab_rx_t *)hdlc;
+    _log(&rx->log, LOG_ABORT);
+    _log(&rx->log, hdlc->frame_len);
+}
+
+static void _tab_oversize(hdlc_rx_t *hdlc)
+{
+    _log(&((tab_rx_t *)hdlc)->log, LOG_OVERSIZE);
+}
+
+static void _tab_idle(hdlc_rx_t *hdlc)
+{
+    _log(&((tab_rx_t *)hdlc)->log, LOG_IDLE);
+}
+
+static const hdlc_rx_ops_t tab_ops = {
+    .idle_bits = IDLE_BITS,
+    .max_len = MTU,
+    .begin = _tab_begin,
+    .add_byte = _tab_add_byte,
+    .is_wanted = _tab_is_wanted,
+    .end = _tab_end,
+    .skipped = _tab_skipped,
+    .aborted = _tab_aborted,
+    .oversize = _tab_oversize,
+    .idle = _tab_idle,
+};
+
+/*** Bitstream under construction, packed MSB first as the RX DMA delivers it */
+typedef struct
+{
+    uint8_t bytes[STREAM_MAX];
+    size_t bits;
+} bitstream_t;
+
+static void _put_bit(bitstream_t *s, uint32_t bit)
+{
+    if (s->bits >= STREAM_MAX * 8)
+    {
+        return;
+    }
+    if (bit)
+    {
+        s->bytes[s->bits / 8] |= 0x80 >> (s->bits % 8);
+    }
+    s->bits++;
+}
+
+static void _put_flag(bitstream_t *s)
+{
+    for (int i = 0; i < 8; i++)
+    {
+        _put_bit(s, (0x7e >> i) & 1);
+    }
+}
+
+static void _put_ones(bitstream_t *s, int n)
+{
+    for (int i = 0; i < n; i++)
+    {
+        _put_bit(s, 1);
+    }
+}
+
+/*** A frame as a sender would put it on the line: LSB first, stuffed, between flags */
+static void _put_frame(bitstream_t *s, int len)
+{
+    int ones = 0;
+    _put_flag(s);
+    for (int i = 0; i < len; i++)
+    {
+        // Mostly 1s, so the stuffing gets plenty of work
+        uint8_t c = test_rand() & test_rand();
+        c = ~c;
+        for (int j = 0; j < 8; j++)
+        {
+            uint32_t bit = (c >> j) & 1;
+            _put_bit(s, bit);
+            ones = bit ? ones + 1 : 0;
+            if (ones == 5)
+            {
+                _put_bit(s, 0);
+                ones = 0;
+            }
+        }
+    }
+    _put_flag(s);
+}
+
+static void _make_random_stream(bitstream_t *s)
+{
+    memset(s, 0, sizeof(*s));
+    size_t len = 1 + test_rand() % STREAM_MAX;
+    for (size_t i = 0; i < len; i++)
+    {
+        s->bytes[i] = test_rand();
+    }
+    s->bits = len * 8;
+}
+
+static void _make_busy_stream(bitstream_t *s)
+{
+    memset(s, 0, sizeof(*s));
+    while (s->bits < (STREAM_MAX - 128) * 8)
+    {
+        switch (test_rand() % 6)
+        {
+        case 0:
+            _put_flag(s);
+            break;
+        case 1:
+            // Abort, sometimes running on into idle
+            _put_bit(s, 0);
+            _put_ones(s, 7 + test_rand() % 12);
+            break;
+        case 2:
+            _put_ones(s, 1 + test_rand() % 24);
+            break;
+        case 3:
+        case 4:
+            _put_frame(s, test_rand() % (MTU + 8));
+            break;
+        default:
+            // Noise, heavy on 1s
+            for (int n = 1 + test_rand() % 40; n > 0; n--)
+            {
+                _put_bit(s, (test_rand() & 3) != 0);
+            }
+            break;
+        }
+    }
+}
+
+static size_t total_frames;
+static size_t total_skipped;
+
+static void _check_stream(const bitstream_t *s, const char *kind, int n)
+{
+    static ref_rx_t ref;
+    static tab_rx_t tab;
+    memset(&ref, 0, sizeof(ref));
+    memset(&tab, 0, sizeof(tab));
+
+    size_t bytes = (s->bits + 7) / 8;
+    for (size_t i = 0; i < bytes; i++)
+    {
+        // Now and then we're sending, so the line can't go idle
+        bool is_line_held = (i / 64) % 5 == 4;
+        _ref_clk_byte(&ref, s->bytes[i], is_line_held);
+        hdlc_rx_clk_byte(&tab.hdlc, &tab_ops, s->bytes[i], is_line_held);
+
+        bool is_ref_active = ref.is_frame_active && !ref.is_skipping;
+        bool is_ref_skipping = ref.is_frame_active && ref.is_skipping;
+        bool is_tab_active = tab.hdlc.frame_state == HDLC_FRAME_ACTIVE;
+        bool is_tab_skipping = tab.hdlc.frame_state == HDLC_FRAME_SKIP;
+        CHECK(ref.log.len == tab.log.len, "%s stream %d byte %zu: %zu events vs %zu", kind, n, i, ref.log.len, tab.log.len);
+        CHECK(is_ref_active == is_tab_active, "%s stream %d byte %zu: frame active %d vs %d", kind, n, i, is_ref_active, is_tab_active);
+        CHECK(is_ref_skipping == is_tab_skipping, "%s stream %d byte %zu: frame skipped %d vs %d", kind, n, i, is_ref_skipping, is_tab_skipping);
+        CHECK(!is_ref_active || ref.frame_len == tab.hdlc.frame_len, "%s stream %d byte %zu: frame length %u vs %u", kind, n, i, ref.frame_len, tab.hdlc.frame_len);
+        CHECK(ref.idle_one_counter == tab.hdlc.idle_ones, "%s stream %d byte %zu: idle count %u vs %u", kind, n, i, ref.idle_one_counter, tab.hdlc.idle_ones);
+        if (test_failures)
+        {
+            return;
+        }
+    }
+
+    CHECK(memcmp(ref.log.entries, tab.log.entries, ref.log.len * sizeof(uint32_t)) == 0, "%s stream %d: events differ", kind, n);
+    for (size_t i = 0; i < ref.log.len; i++)
+    {
+        switch (ref.log.entries[i])
+        {
+        case LOG_FRAME:
+            total_frames++;
+            i += 1 + ref.log.entries[i + 1];
+            break;
+        case LOG_SKIPPED:
+            total_skipped++;
+            i++;
+            break;
+        case LOG_ABORT:
+            i++;
+            break;
+        }
+    }
+}
+
+static void _test_deframer(void)
+{
+    static bitstream_t s;
+    for (int n = 0; n < 200 && !test_failures; n++)
+    {
+        _make_random_stream(&s);
+        _check_stream(&s, "random", n);
+    }
+    for (int n = 0; n < 200 && !test_failures; n++)
+    {
+        _make_busy_stream(&s);
+        _check_stream(&s, "busy", n);
+    }
+
+    // Make sure the streams really did exercise the frame and skip paths
+    CHECK(total_frames > 10000, "only %zu frames seen", total_frames);
+    CHECK(total_skipped > 1000, "only %zu frames skipped", total_skipped);
+    printf("%zu frames kept, %zu skipped\n", total_frames, total_skipped);
+}
+
+/*** Bit at a time stuffer, as econet_tx.c had before the table */
+typedef struct
+{
+    uint8_t *bits;
+    size_t bits_size;
+    uint32_t byte_pos;
+    uint32_t bit_pos;
+    uint8_t one_count;
+    uint8_t c;
+} ref_tx_t;
+
+static void _ref_add_raw_bit(ref_tx_t *ctx, uint8_t b)
+{
+    ctx->c = ctx->c << HDLC_TX_SYMBOL_BITS | b;
+    ctx->bit_pos += HDLC_TX_SYMBOL_BITS;
+    if (ctx->bit_pos >= 8)
+    {
+        if (ctx->byte_pos < ctx->bits_size)
+        {
+            ctx->bits[ctx->byte_pos] = ctx->c;
+        }
+        ctx->c = 0;
+        ctx->bit_pos = 0;
+        ctx->byte_pos++;
+    }
+}
+
+static void _ref_add_bit(ref_tx_t *ctx, uint8_t bit)
+{
+    _ref_add_raw_bit(ctx, (bit ? 1 : 0) | 2);
+}
+
+static void _ref_add_byte_unstuffed(ref_tx_t *ctx, uint8_t c)
+{
+    for (int j = 0; j < 8; j++)
+    {
+        _ref_add_bit(ctx, c & 1);
+        c >>= 1;
+    }
+}
+
+static void _ref_add_byte_stuffed(ref_tx_t *ctx, uint8_t c)
+{
+    for (int j = 0; j < 8; j++)
+    {
+        uint8_t bit = (c & 1);
+        _ref_add_bit(ctx, bit);
+        c >>= 1;
+        if (bit != 0)
+        {
+            ctx->one_count += 1;
+        }
+        else
+        {
+            ctx->one_count = 0;
+        }
+
+        // Bit stuffing
+        if (ctx->one_count == 5)
+        {
+            _ref_add_bit(ctx, 0);
+            ctx->one_count = 0;
+        }
+    }
+}
+
+/*** The old frame encoder, less the opening flags now sent by the flag fill */
+static size_t _ref_encode_frame(uint8_t *bits, size_t bits_size, const uint8_t *payload, size_t payload_length)
+{
+    ref_tx_t ctx = {
+        .bits = bits,
+        .bits_size = bits_size,
+    };
+    for (size_t i = 0; i < payload_length; i++)
+    {
+        _ref_add_byte_stuffed(&ctx, payload[i]);
+    }
+    uint16_t fcs = crc16_x25(payload, payload_length);
+    _ref_add_byte_stuffed(&ctx, fcs & 0xFF);
+    _ref_add_byte_stuffed(&ctx, fcs >> 8);
+    _ref_add_byte_unstuffed(&ctx, 0x7e);
+    while (ctx.bit_pos || (ctx.byte_pos % 4) != 0)
+    {
+        _ref_add_raw_bit(&ctx, 0);
+    }
+    if (ctx.byte_pos > ctx.bits_size)
+    {
+        return 0;
+    }
+    return ctx.byte_pos;
+}
+
+static void _test_stuff_table(void)
+{
+    for (int run = 0; run < HDLC_TX_RUN_STATES; run++)
+    {
+        for (int c = 0; c < 256; c++)
+        {
+            // One byte from the given run, written out a byte of symbols
+            // at a time so it can be compared with the table entry
+            uint8_t bits[4] = {};
+            ref_tx_t ref = {
+                .bits = bits,
+                .bits_size = sizeof(bits),
+                .one_count = run,
+            };
+            _ref_add_byte_stuffed(&ref, c);
+            uint32_t ref_len = (ref.byte_pos * 8 + ref.bit_pos) / HDLC_TX_SYMBOL_BITS;
+            uint32_t ref_symbols = 0;
+            for (uint32_t i = 0; i < ref.byte_pos; i++)
+            {
+                ref_symbols = ref_symbols << 8 | bits[i];
+            }
+            ref_symbols = ref_symbols << ref.bit_pos | ref.c;
+
+            hdlc_tx_step_t step = hdlc_tx_table[run][c];
+            CHECK(step.len == ref_len, "run=%d c=0x%02x: %u bits vs %u", run, c, step.len, ref_len);
+            CHECK(step.symbols == ref_symbols, "run=%d c=0x%02x: symbols 0x%05x vs 0x%05x", run, c, step.symbols, ref_symbols);
+            CHECK(step.next_run == ref.one_count, "run=%d c=0x%02x: next run %u vs %u", run, c, step.next_run, ref.one_count);
+        }
+    }
+}
+
+static void _test_encode_frame(void)
+{
+    static uint8_t payload[1024];
+    static uint8_t ref_bits[sizeof(payload) * 4] __attribute__((aligned(4)));
+    static uint8_t tab_bits[sizeof(payload) * 4] __attribute__((aligned(4)));
+
+    for (int n = 0; n < 2000; n++)
+    {
+        size_t len = test_rand() % sizeof(payload);
+        uint32_t mask = test_rand();
+        for (size_t i = 0; i < len; i++)
+        {
+            // Bias some frames towards 1s so that most bytes get stuffed
+            payload[i] = test_rand() | (n & 1 ? mask : 0);
+        }
+
+        // Sometimes too small, which both have to notice
+        size_t bits_size = sizeof(ref_bits);
+        if (n % 7 == 0)
+        {
+            bits_size = (test_rand() % (len * 3 + 16)) & ~3;
+        }
+
+        memset(ref_bits, 0, sizeof(ref_bits));
+        memset(tab_bits, 0, sizeof(tab_bits));
+        size_t ref_len = _ref_encode_frame(ref_bits, bits_size, payload, len);
+        size_t tab_len = hdlc_tx_encode_frame(tab_bits, bits_size, payload, len);
+        CHECK(ref_len == tab_len, "frame %d len=%zu: %zu bytes vs %zu", n, len, tab_len, ref_len);
+        CHECK(memcmp(ref_bits, tab_bits, ref_len) == 0, "frame %d len=%zu: bits differ", n, len);
+        if (test_failures)
+        {
+            return;
+        }
+    }
+}
+
+static double _seconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*** Not a pass/fail check, just to show what the table buys on this host */
+static void _bench_encode_frame(void)
+{
+    static uint8_t payload[BENCH_FRAME];
+    static uint8_t bits[BENCH_FRAME * 4] __attribute__((aligned(4)));
+    for (size_t i = 0; i < sizeof(payload); i++)
+    {
+        payload[i] = test_rand();
+    }
+
+    const int rounds = 200;
+    double start = _seconds();
+    for (int i = 0; i < rounds; i++)
+    {
+        _ref_encode_frame(bits, sizeof(bits), payload, sizeof(payload));
+    }
+    double ref_s = _seconds() - start;
+
+    start = _seconds();
+    for (int i = 0; i < rounds; i++)
+    {
+        hdlc_tx_encode_frame(bits, sizeof(bits), payload, sizeof(payload));
+    }
+    double tab_s = _seconds() - start;
+
+    printf("Encoding a %d byte frame: %.1f us bit at a time, %.1f us table driven\n",
+           BENCH_FRAME, ref_s * 1e6 / rounds, tab_s * 1e6 / rounds);
+}
+
+int main(void)
+{
+    crc16_x25_init();
+    hdlc_rx_build_table();
+    hdlc_tx_build_table();
+    _test_deframer();
+    _test_stuff_table();
+    _test_encode_frame();
+    _bench_encode_frame();
+    return test_result("test_hdlc");
+}
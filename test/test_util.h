@@ -0,0 +1,55 @@
+/*
+ * EconetWiFi
+ * Copyright (c) 2025 Paul G. Banks <https://paulbanks.org/projects/econet>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * See the LICENSE file in the project root for full license information.
+ */
+
+#pragma once
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+static int test_failures;
+
+// Report a failed check and carry on, so one run shows every failure
+#define CHECK(cond, ...)                                               \
+    do                                                                 \
+    {                                                                  \
+        if (!(cond))                                                   \
+        {                                                              \
+            fprintf(stderr, "%s:%d: %s: ", __FILE__, __LINE__, #cond); \
+            fprintf(stderr, __VA_ARGS__);                              \
+            fprintf(stderr, "\n");                                     \
+            test_failures++;                                           \
+        }                                                              \
+    } while (0)
+
+static inline int test_result(const char *name)
+{
+    if (test_failures)
+    {
+        fprintf(stderr, "%s: %d failures\n", name, test_failures);
+        return EXIT_FAILURE;
+    }
+    printf("%s: passed\n", name);
+    return EXIT_SUCCESS;
+}
+
+/*** Repeatable pseudo-random numbers (xorshift32) */
+static uint32_t test_rand_state = 2463534242u;
+
+static inline uint32_t test_rand(void)
+{
+    uint32_t x = test_rand_state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return test_rand_state = x;
+}
@@ -39,6 +39,36 @@ export const econetStats = writable<EconetStats>({
   rx_nack_count: 0,
   tx_frame_count: 0,
   tx_ack_count: 0,
+  rx_isr_count: 0,
+  rx_ack_latency_avg_us: 0,
+  rx_ack_latency_max_us: 0,
+  rx_filtered_count: 0,
+  rx_no_buffer_count: 0,
+  rx_unpaired_count: 0,
+  rx_idle_count: 0,
+  rx_idle_signal_avg_cycles: 0,
+  tx_ack_fast_count: 0,
+  tx_ack_cache_hit_count: 0,
+  tx_ack_cache_miss_count: 0,
+  rx_line_busy_bits: 0,
+  rx_line_idle_bits: 0,
+  rx_line_util_pc: 0,
+  rx_line_util_peak_pc: 0,
+  rx_frame_len_hist: [],
+  tx_underrun_count: 0,
+  tx_gap_hist: [],
+  tx_queue_depth: [],
+  tx_queue_depth_peak: [],
+  tx_queue_wait_avg_us: [],
+  tx_queue_wait_max_us: [],
+  tx_scout_retry_count: 0,
+  tx_scout_collision_count: 0,
+  tx_scout_defer_count: 0,
+  tx_scout_giveup_count: 0,
+  tx_phase_hist: [],
+  tx_phase_max_us: [],
+  rx_bit_clock_hz: 0,
+  tx_ack_turnaround_hist: [],
 });
 
 export const aunbridgeStats = writable<AunbridgeStats>({
@@ -57,6 +87,10 @@ export const aunbridgeStats = writable<AunbridgeStats>({
   rx_unknown_count: 0,
   rx_bridge_control: 0,
   rx_broadcast_count: 0,
+  imm_cache_hit_count: 0,
+  imm_cache_miss_count: 0,
+  rx_drop_count: 0,
+  peers: [],
 });
 
 export type LogLevel = "info" | "warn" | "error" | "other";
@@ -20,6 +20,36 @@ export type EconetStats = {
   rx_nack_count: number;
   tx_frame_count: number;
   tx_ack_count: number;
+  rx_isr_count: number;
+  rx_ack_latency_avg_us: number;
+  rx_ack_latency_max_us: number;
+  rx_filtered_count: number;
+  rx_no_buffer_count: number;
+  rx_unpaired_count: number;
+  rx_idle_count: number;
+  rx_idle_signal_avg_cycles: number;
+  tx_ack_fast_count: number;
+  tx_ack_cache_hit_count: number;
+  tx_ack_cache_miss_count: number;
+  rx_line_busy_bits: number;
+  rx_line_idle_bits: number;
+  rx_line_util_pc: number;
+  rx_line_util_peak_pc: number;
+  rx_frame_len_hist: number[];
+  tx_underrun_count: number;
+  tx_gap_hist: number[];
+  tx_queue_depth: number[];
+  tx_queue_depth_peak: number[];
+  tx_queue_wait_avg_us: number[];
+  tx_queue_wait_max_us: number[];
+  tx_scout_retry_count: number;
+  tx_scout_collision_count: number;
+  tx_scout_defer_count: number;
+  tx_scout_giveup_count: number;
+  tx_phase_hist: number[][];
+  tx_phase_max_us: number[];
+  rx_bit_clock_hz: number;
+  tx_ack_turnaround_hist: number[];
 };
 
 export type AunbridgeStats = {
@@ -38,6 +68,19 @@ export type AunbridgeStats = {
   rx_unknown_count: number;
   rx_bridge_control: number;
   rx_broadcast_count: number;
+  imm_cache_hit_count: number;
+  imm_cache_miss_count: number;
+  rx_drop_count: number;
+  peers: AunPeerStats[];
+};
+
+export type AunPeerStats = {
+  name: string;
+  srtt_us: number;
+  rttvar_us: number;
+  rto_us: number;
+  rtt_max_us: number;
+  retry_count: number;
 };
 
 export type WifiSettings = {
@@ -72,6 +115,7 @@ export type EconetSettings = {
   econet?: {
     localStations?: ECSRow[];
     remoteStations?: AUNRow[];
+    retransmitCapMs?: number;
   };
   trunks?: {
     ourNetwork?: number;
@@ -86,6 +130,7 @@ export type EconetClockSettings = {
   internalFrequencyHz: number;
   internalDutyCycle: number; // percent, 0–100
   invertClock?: boolean;
+  turnaroundMs: number;
 };
 
 export type StatsStreamPayload = {